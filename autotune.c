@@ -0,0 +1,240 @@
+/*
+ *  Block-size autotuner for dgemm-blocked-final.c
+ *
+ *  For each size bucket (see dgemm.h) it times a few representative square
+ *  sizes and greedily searches the block sizes one parameter at a time,
+ *  starting from the ones derived from the host's caches (the software
+ *  prefetch distances are searched the same way),
+ *  all in one process through dgemm_set_blocking. The winners are written
+ *  to the tuning file that dgemm loads on its first call.
+ *
+ *  Usage: autotune [-o <file>] [-p <passes>] [-s] [-k]
+ *  Run it with the DGEMM_KERNEL (and DGEMM_NUM_THREADS) setting you want
+ *  tuned; the file keeps one set of lines per kernel. -s tunes sgemm
+ *  instead, into SGEMM_TUNING or sgemm-tuning.txt. -k first scores every
+ *  register tile this CPU can run on its derived block sizes, then tunes
+ *  the fastest and records it in the file as the kernel to use.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "dgemm.h"
+#include "timing.h"
+
+/* The routines being tuned: dgemm's, or sgemm's with -s */
+static int single = 0;
+static int (*get_blocking) (int, dgemm_blocking*) = dgemm_get_blocking;
+static int (*set_blocking) (int, const dgemm_blocking*) = dgemm_set_blocking;
+static int (*save_tuning) (const char*) = dgemm_save_tuning;
+static const char* (*kernel_name) (void) = dgemm_kernel_name;
+static const char* (*kernel_at) (int) = dgemm_kernel_at;
+static int (*set_kernel) (const char*) = dgemm_set_kernel;
+
+/* One n x n multiply; the buffers hold either element type */
+static void multiply (int n, double* A, double* B, double* C)
+{
+  if (single)
+    square_sgemm (n, (float*) A, (float*) B, (float*) C);
+  else
+    square_dgemm (n, A, B, C);
+}
+
+/* Representative sizes per bucket; the smallest sizes of bucket 0 take the
+ * unpacked path and don't depend on the block sizes at all */
+static const int bucket_sizes[DGEMM_BUCKETS][3] = {
+  {  80,  97, 127 },
+  { 192, 320, 511 },
+  { 640, 768, 1025 },
+};
+
+/* Candidate values per parameter, in dgemm_blocking field order, ending
+ * in -1 (0 turns a prefetch off) */
+#define NPARAMS 9
+static const char* param_names[NPARAMS] = { "mc", "kc", "nc", "l1_m", "l1_n", "l1_k", "pf_a", "pf_b", "pf_c" };
+static const int candidates[NPARAMS][10] = {
+  { 24, 48, 72, 96, 120, 144, 192, 240, -1 },
+  { 48, 64, 96, 128, 176, 192, 240, 256, 384, -1 },
+  { 96, 192, 240, 384, 480, 744, 1008, 1536, -1 },
+  { 24, 48, 72, 96, 120, 192, -1 },
+  { 16, 24, 32, 48, 64, 96, -1 },
+  { 16, 32, 64, 128, 192, 256, 384, -1 },
+  { 0, 2, 4, 8, 16, 32, -1 },
+  { 0, 2, 4, 8, 16, 32, -1 },
+  { 0, 1, 2, 4, -1 },
+};
+
+static int* param (dgemm_blocking* b, int i)
+{
+  int* fields[NPARAMS] = { &b->mc, &b->kc, &b->nc, &b->l1_m, &b->l1_n, &b->l1_k, &b->pf_a, &b->pf_b, &b->pf_c };
+  return fields[i];
+}
+
+static void fill (double* p, int n)
+{
+  for (int i = 0; i < n; ++i){
+    if (single)
+      ((float*) p)[i] = 2.0 * drand48 () - 1.0;
+    else
+      p[i] = 2.0 * drand48 () - 1.0;
+  }
+}
+
+typedef struct {
+  int n;
+  double *A, *B, *C;
+} size_call;
+
+static void size_fn (void* arg)
+{
+  size_call* c = (size_call*) arg;
+  multiply (c->n, c->A, c->B, c->C);
+}
+
+/* Median Gflop/s of one size over a few samples, so one preempted sample
+ * can't make a candidate win */
+static double time_size (int n, double* A, double* B, double* C)
+{
+  timing_options opt = { 1, 3, 0.02, 0, NULL, NULL };
+  timing_stats t;
+  size_call c = { n, A, B, C };
+  time_trials (size_fn, &c, &opt, &t);
+  return 2.e-9 * n * n * n / t.median;
+}
+
+/* Mean Gflop/s of the bucket's sizes under b */
+static double score (int bucket, const dgemm_blocking* b, double* A, double* B, double* C)
+{
+  set_blocking (bucket, b);
+  double sum = 0.0;
+  for (int i = 0; i < 3; ++i)
+    sum += time_size (bucket_sizes[bucket][i], A, B, C);
+  return sum / 3;
+}
+
+/* Mean Gflop/s of the i-th kernel over all buckets, on its derived
+ * block sizes; sets it, so the winner has to be set again */
+static double score_kernel (int i, double* A, double* B, double* C)
+{
+  set_kernel (kernel_at (i));
+  double sum = 0.0;
+  for (int bucket = 0; bucket < DGEMM_BUCKETS; ++bucket){
+    dgemm_blocking b;
+    get_blocking (bucket, &b);
+    sum += score (bucket, &b, A, B, C);
+  }
+  return sum / DGEMM_BUCKETS;
+}
+
+int main (int argc, char **argv)
+{
+  const char* path = NULL;
+  int passes = 2;
+  int kernels = 0;
+  int c;
+  while ((c = getopt (argc, argv, "o:p:sk")) != -1){
+    switch (c) {
+      case 'o':
+        path = optarg;
+        break;
+      case 'p':
+        passes = atoi (optarg);
+        break;
+      case 's':
+        single = 1;
+        get_blocking = sgemm_get_blocking;
+        set_blocking = sgemm_set_blocking;
+        save_tuning = sgemm_save_tuning;
+        kernel_name = sgemm_kernel_name;
+        kernel_at = sgemm_kernel_at;
+        set_kernel = sgemm_set_kernel;
+        break;
+      case 'k':
+        kernels = 1;
+        break;
+      default:
+        printf ("Usage: autotune [-o <file>] [-p <passes>] [-s] [-k]\n");
+        exit (-1);
+    }
+  }
+  if (path == NULL)
+    path = getenv (single ? "SGEMM_TUNING" : "DGEMM_TUNING");
+  if (path == NULL)
+    path = single ? "sgemm-tuning.txt" : "dgemm-tuning.txt";
+
+  int nmax = bucket_sizes[DGEMM_BUCKETS-1][2];
+  double* buf = (double*) malloc (3 * (size_t) nmax * nmax * sizeof(double));
+  if (buf == NULL){
+    perror ("Failed to allocate matrices");
+    exit (EXIT_FAILURE);
+  }
+  double* A = buf;
+  double* B = A + nmax * nmax;
+  double* C = B + nmax * nmax;
+  fill (A, nmax * nmax);
+  fill (B, nmax * nmax);
+  fill (C, nmax * nmax);
+
+  if (kernels){
+    int best = 0;
+    double best_score = 0.0;
+    for (int i = 0; kernel_at (i); ++i){
+      double s = score_kernel (i, A, B, C);
+      printf ("Kernel %s: %.3g Gflop/s\n", kernel_at (i), s);
+      if (s > best_score){
+        best = i;
+        best_score = s;
+      }
+    }
+    set_kernel (kernel_at (best));
+  }
+
+  printf ("Kernel: %s (%s)\n", kernel_name (), single ? "sgemm" : "dgemm");
+
+  for (int bucket = 0; bucket < DGEMM_BUCKETS; ++bucket){
+    dgemm_blocking best;
+    get_blocking (bucket, &best);
+    double best_score = score (bucket, &best, A, B, C);
+    printf ("Bucket %d start: mc %d kc %d nc %d l1_m %d l1_n %d l1_k %d pf_a %d pf_b %d pf_c %d (%.3g Gflop/s)\n",
+            bucket, best.mc, best.kc, best.nc, best.l1_m, best.l1_n, best.l1_k, best.pf_a, best.pf_b, best.pf_c,
+            best_score);
+
+    /* Coordinate descent: sweep each parameter with the others fixed */
+    for (int pass = 0; pass < passes; ++pass){
+      int improved = 0;
+      for (int p = 0; p < NPARAMS; ++p){
+        for (int v = 0; candidates[p][v] >= 0; ++v){
+          dgemm_blocking trial = best;
+          if (*param (&trial, p) == candidates[p][v])
+            continue;
+          *param (&trial, p) = candidates[p][v];
+          double s = score (bucket, &trial, A, B, C);
+          if (s > best_score){
+            best = trial;
+            best_score = s;
+            improved = 1;
+            printf ("Bucket %d %s=%d: %.3g Gflop/s\n", bucket, param_names[p], candidates[p][v], s);
+          }
+        }
+      }
+      if (!improved)
+        break;
+    }
+
+    set_blocking (bucket, &best);
+    printf ("Bucket %d best: mc %d kc %d nc %d l1_m %d l1_n %d l1_k %d pf_a %d pf_b %d pf_c %d (%.3g Gflop/s)\n",
+            bucket, best.mc, best.kc, best.nc, best.l1_m, best.l1_n, best.l1_k, best.pf_a, best.pf_b, best.pf_c,
+            best_score);
+  }
+
+  if (save_tuning (path) != 0){
+    perror (path);
+    exit (EXIT_FAILURE);
+  }
+  printf ("Wrote %s\n", path);
+
+  free (buf);
+  return 0;
+}
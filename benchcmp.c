@@ -0,0 +1,351 @@
+/*
+ *  Compares two benchmark runs recorded with -f csv (or -P csv).
+ *
+ *  Records are matched on mode, precision, op, sizes, batch and threads.
+ *  For each pair the per-sample times are compared with a two-sided
+ *  Mann-Whitney U test (normal approximation, tie-corrected), which makes
+ *  no assumption about the shape of the timing noise. A full sweep is a
+ *  couple of hundred tests, so the p-values are held to a Benjamini-
+ *  Hochberg cutoff that keeps the expected share of false alarms among the
+ *  flagged records at alpha. A pair is a regression when the new median
+ *  time is slower by more than the threshold and its p-value is under that
+ *  cutoff; the exit status is 1 if any pair regressed, so kernel changes
+ *  can be gated on it.
+ *
+ *  With -c <counter> (runs recorded with -P csv) it compares that counter
+ *  per flop instead, e.g. -c l2_misses for a change meant to save cache
+ *  misses. The counters are one total per record, so there is no test:
+ *  a pair regresses when its count per flop rises by more than the
+ *  threshold.
+ *
+ *      ./benchcmp [-a <alpha>] [-t <threshold %>] [-c <counter>] base.csv new.csv
+ */
+
+#include <stdlib.h> // For: exit, malloc, realloc, free, qsort, atof, strtod
+#include <stdio.h>  // For: fopen, fgets, printf
+#include <string.h> // For: strcmp, strncmp, strchr, strcspn
+#include <math.h>   // For: sqrt, erfc, fabs
+#include <getopt.h>
+
+#define MAX_SAMPLES 256
+
+/* One record: its key and its samples (seconds per call) */
+typedef struct {
+  char key[128];
+  double gflops;
+  double per_flop;    /* the -c counter per flop, negative if not counted */
+  int nsamples;
+  double samples[MAX_SAMPLES];
+} result;
+
+typedef struct {
+  char kernel[256];
+  char desc[256];
+  char cpu[256];
+  int n;
+  result* r;
+} run;
+
+static void usage (void)
+{
+  fprintf (stderr, "Usage: benchcmp [-a <alpha>] [-t <threshold %%>] [-c <counter>] base.csv new.csv\n");
+  exit (2);
+}
+
+/* Splits line at the commas in place; returns the number of fields */
+static int split (char* line, char** fields, int max)
+{
+  int n = 0;
+  line[strcspn (line, "\r\n")] = 0;
+  while (n < max){
+    fields[n++] = line;
+    char* comma = strchr (line, ',');
+    if (comma == NULL)
+      break;
+    *comma = 0;
+    line = comma + 1;
+  }
+  return n;
+}
+
+static int column (char** header, int n, const char* name)
+{
+  for (int i = 0; i < n; ++i)
+    if (strcmp (header[i], name) == 0)
+      return i;
+  return -1;
+}
+
+static void meta (const char* line, const char* key, char* value, int size)
+{
+  int len = strlen (key);
+  if (strncmp (line + 2, key, len) == 0 && line[2 + len] == ':'){
+    snprintf (value, size, "%s", line + 3 + len + (line[3 + len] == ' '));
+    value[strcspn (value, "\r\n")] = 0;
+  }
+}
+
+/* The -c counter, or NULL to compare timings */
+static const char* counter = NULL;
+
+static void read_run (const char* path, run* out)
+{
+  static const char* keys[] = { "mode", "prec", "op", "m", "n", "k", "batch", "threads" };
+  const int nkeys = sizeof(keys)/sizeof(keys[0]);
+  char line[16384], header_line[16384];
+  char* header[64];
+  int nheader = 0, key_col[8], gflops_col = -1, samples_col = -1, seconds_col = -1, counter_col = -1;
+  int cap = 0;
+
+  FILE* f = fopen (path, "r");
+  if (f == NULL){
+    perror (path);
+    exit (2);
+  }
+  memset (out, 0, sizeof(*out));
+  while (fgets (line, sizeof(line), f)){
+    if (line[0] == '#'){
+      meta (line, "kernel", out->kernel, sizeof(out->kernel));
+      meta (line, "desc", out->desc, sizeof(out->desc));
+      meta (line, "cpu", out->cpu, sizeof(out->cpu));
+      continue;
+    }
+    if (nheader == 0){
+      strcpy (header_line, line);
+      nheader = split (header_line, header, 64);
+      for (int i = 0; i < nkeys; ++i)
+        key_col[i] = column (header, nheader, keys[i]);
+      gflops_col = column (header, nheader, "gflops");
+      samples_col = column (header, nheader, "samples");
+      seconds_col = column (header, nheader, "seconds");
+      if (samples_col < 0 || gflops_col < 0 || seconds_col < 0 || key_col[0] < 0){
+        fprintf (stderr, "%s: not a benchmark -f csv run\n", path);
+        exit (2);
+      }
+      if (counter && (counter_col = column (header, nheader, counter)) < 0){
+        fprintf (stderr, "%s: no %s column (record it with -P csv)\n", path, counter);
+        exit (2);
+      }
+      continue;
+    }
+
+    char* fields[64];
+    int nfields = split (line, fields, 64);
+    if (nfields < nheader)
+      continue;
+    if (out->n == cap){
+      cap = cap ? 2 * cap : 64;
+      out->r = (result*) realloc (out->r, cap * sizeof(result));
+      if (out->r == NULL){
+        perror ("benchcmp");
+        exit (2);
+      }
+    }
+    result* r = &out->r[out->n++];
+    r->key[0] = 0;
+    for (int i = 0; i < nkeys; ++i)
+      if (key_col[i] >= 0){
+        int len = strlen (r->key);
+        snprintf (r->key + len, sizeof(r->key) - len, "%s%s", i ? " " : "", fields[key_col[i]]);
+      }
+    r->gflops = atof (fields[gflops_col]);
+    /* Counters are per call, like seconds */
+    double flops = 1.e9 * r->gflops * atof (fields[seconds_col]);
+    r->per_flop = counter_col >= 0 && *fields[counter_col] && flops > 0 ? atof (fields[counter_col]) / flops : -1.0;
+    r->nsamples = 0;
+    char* p = fields[samples_col];
+    while (*p && r->nsamples < MAX_SAMPLES){
+      char* end;
+      r->samples[r->nsamples++] = strtod (p, &end);
+      p = *end == ';' ? end + 1 : end;
+      if (end == p && *p)
+        break;
+    }
+  }
+  fclose (f);
+}
+
+static int compare (const void* a, const void* b)
+{
+  double x = *(const double*) a, y = *(const double*) b;
+  return x < y ? -1 : x > y;
+}
+
+static double median (const double* x, int n)
+{
+  double s[MAX_SAMPLES];
+  memcpy (s, x, n * sizeof(double));
+  qsort (s, n, sizeof(double), compare);
+  return n % 2 ? s[n / 2] : 0.5 * (s[n / 2 - 1] + s[n / 2]);
+}
+
+/* Two-sided p-value of the Mann-Whitney U test of a against b: midranks
+ * for ties, the normal approximation with tie and continuity corrections */
+static double mann_whitney (const double* a, int na, const double* b, int nb)
+{
+  int n = na + nb;
+  double v[2 * MAX_SAMPLES];
+  int from_a[2 * MAX_SAMPLES];
+  /* Merge, then sort by value carrying the origin along */
+  for (int i = 0; i < na; ++i){ v[i] = a[i]; from_a[i] = 1; }
+  for (int i = 0; i < nb; ++i){ v[na + i] = b[i]; from_a[na + i] = 0; }
+  for (int i = 1; i < n; ++i)
+    for (int j = i; j > 0 && v[j - 1] > v[j]; --j){
+      double t = v[j]; v[j] = v[j - 1]; v[j - 1] = t;
+      int o = from_a[j]; from_a[j] = from_a[j - 1]; from_a[j - 1] = o;
+    }
+
+  double rank_a = 0.0, ties = 0.0;
+  for (int i = 0; i < n; ){
+    int j = i;
+    while (j < n && v[j] == v[i])
+      ++j;
+    double rank = 0.5 * (i + 1 + j);
+    for (int k = i; k < j; ++k)
+      if (from_a[k])
+        rank_a += rank;
+    double t = j - i;
+    ties += t * t * t - t;
+    i = j;
+  }
+
+  double u = rank_a - 0.5 * na * (na + 1);
+  double mean = 0.5 * na * nb;
+  double var = na * nb / 12.0 * ((n + 1) - ties / ((double) n * (n - 1)));
+  if (var <= 0)
+    return 1.0;
+  double z = (fabs (u - mean) - 0.5) / sqrt (var);
+  if (z < 0)
+    z = 0;
+  return erfc (z / sqrt (2.0));
+}
+
+static int find (const run* r, const char* key)
+{
+  for (int j = 0; j < r->n; ++j)
+    if (strcmp (r->r[j].key, key) == 0)
+      return j;
+  return -1;
+}
+
+/* -c: the counter per flop of each pair; returns 1 if any rose by more
+ * than threshold % */
+static int compare_counter (const run* base, const run* next, double threshold)
+{
+  int compared = 0, regressions = 0;
+  printf ("%-40s %12s %12s %8s  %s\n", "record", "base /kflop", "new /kflop", "change", counter);
+  for (int i = 0; i < next->n; ++i){
+    const result* r = &next->r[i];
+    int j = find (base, r->key);
+    if (j < 0 || r->per_flop < 0 || base->r[j].per_flop <= 0)
+      continue;
+    double change = 100. * (r->per_flop / base->r[j].per_flop - 1.);
+    const char* verdict = "";
+    if (change > threshold){
+      verdict = "REGRESSION";
+      ++regressions;
+    }
+    else if (change < -threshold)
+      verdict = "fewer";
+    printf ("%-40s %12.4g %12.4g %+7.1f%%  %s\n", r->key, 1.e3 * base->r[j].per_flop, 1.e3 * r->per_flop,
+            change, verdict);
+    ++compared;
+  }
+  printf ("# %d of %d records regressed (%s per flop, threshold %g%%)\n", regressions, compared, counter, threshold);
+  if (compared == 0)
+    fprintf (stderr, "benchcmp: no records with %s counted in both runs\n", counter);
+  free (base->r);
+  free (next->r);
+  return regressions > 0;
+}
+
+int main (int argc, char** argv)
+{
+  double alpha = 0.05, threshold = 2.0;
+  int c;
+  while ((c = getopt (argc, argv, "a:t:c:")) != -1)
+    switch (c){
+      case 'c':
+        counter = optarg;
+        break;
+      case 'a':
+        alpha = atof (optarg);
+        break;
+      case 't':
+        threshold = atof (optarg);
+        break;
+      default:
+        usage ();
+    }
+  if (argc - optind != 2)
+    usage ();
+
+  run base, next;
+  read_run (argv[optind], &base);
+  read_run (argv[optind + 1], &next);
+  printf ("# base: %s (%s)\n# new:  %s (%s)\n", base.desc, base.kernel, next.desc, next.kernel);
+  if (strcmp (base.cpu, next.cpu) != 0)
+    fprintf (stderr, "benchcmp: the runs are from different cpus: %s / %s\n", base.cpu, next.cpu);
+
+  if (counter)
+    return compare_counter (&base, &next, threshold);
+
+  /* The pairs first, then the Benjamini-Hochberg cutoff over their p-values */
+  int* pair = (int*) malloc (next.n * sizeof(int));
+  double* change = (double*) malloc (next.n * sizeof(double));
+  double* p = (double*) malloc (next.n * sizeof(double));
+  double* sorted = (double*) malloc (next.n * sizeof(double));
+  if (next.n > 0 && (pair == NULL || change == NULL || p == NULL || sorted == NULL)){
+    perror ("benchcmp");
+    exit (2);
+  }
+  int compared = 0;
+  for (int i = 0; i < next.n; ++i){
+    const result* r = &next.r[i];
+    pair[i] = -1;
+    for (int j = 0; j < base.n && pair[i] < 0; ++j)
+      if (strcmp (base.r[j].key, r->key) == 0)
+        pair[i] = j;
+    if (pair[i] < 0 || base.r[pair[i]].nsamples == 0 || r->nsamples == 0){
+      pair[i] = -1;
+      continue;
+    }
+    const result* b = &base.r[pair[i]];
+    change[i] = 100. * (median (r->samples, r->nsamples) / median (b->samples, b->nsamples) - 1.);
+    p[i] = mann_whitney (b->samples, b->nsamples, r->samples, r->nsamples);
+    sorted[compared++] = p[i];
+  }
+  qsort (sorted, compared, sizeof(double), compare);
+  double cutoff = 0.0;
+  for (int k = compared; k > 0 && cutoff == 0.0; --k)
+    if (sorted[k - 1] <= alpha * k / compared)
+      cutoff = sorted[k - 1];
+
+  int regressions = 0;
+  printf ("%-40s %10s %10s %8s %8s  %s\n", "record", "base Gf/s", "new Gf/s", "time", "p", "");
+  for (int i = 0; i < next.n; ++i){
+    if (pair[i] < 0)
+      continue;
+    const char* verdict = "";
+    if (p[i] <= cutoff && change[i] > threshold){
+      verdict = "REGRESSION";
+      ++regressions;
+    }
+    else if (p[i] <= cutoff && change[i] < -threshold)
+      verdict = "faster";
+    printf ("%-40s %10.4g %10.4g %+7.1f%% %8.3g  %s\n", next.r[i].key, base.r[pair[i]].gflops, next.r[i].gflops,
+            change[i], p[i], verdict);
+  }
+
+  printf ("# %d of %d records regressed (false discovery rate %g, p cutoff %.3g, threshold %g%%)\n",
+          regressions, compared, alpha, cutoff, threshold);
+  if (compared == 0)
+    fprintf (stderr, "benchcmp: no records in common\n");
+  free (sorted);
+  free (p);
+  free (change);
+  free (pair);
+  free (base.r);
+  free (next.r);
+  return regressions > 0;
+}
@@ -6,12 +6,18 @@
  *      Support CBLAS interface
  */
 
+#ifdef NUMA
+#define _GNU_SOURCE // For: sched_getcpu
+#endif
 #include <stdlib.h> // For: exit, random, malloc, free, NULL, EXIT_FAILURE
 #include <stdio.h>  // For: perror
 #include <string.h> // For: memset
 
 #include <float.h>  // For: DBL_EPSILON
 #include <math.h>   // For: fabs
+#include <pthread.h> // For: pthread_create, pthread_join
+#include <time.h>   // For: time, gmtime, strftime
+#include <unistd.h> // For: gethostname, sysconf
 
 #ifdef USE_MKL
 #include "mkl.h"
@@ -19,7 +25,17 @@
 #include "cblas.h"
 #endif
 
-void cmdLine(int argc, char *argv[], int* n, int* noCheck);
+#ifdef NUMA
+#include <numa.h>   // For: numa_alloc_*, numa_run_on_node
+#include <sched.h>  // For: sched_getcpu
+#endif
+
+#include "cmdLine.h"
+#include "dgemm.h"
+#include "perf-counters.h"
+#include "roofline.h"
+#include "timing.h"
+
 /* reference_dgemm wraps a call to the BLAS-3 routine DGEMM, via the standard FORTRAN interface - hence the reference semantics. */
 void reference_dgemm (int N, double Alpha, double* A, double* B, double* C)
 {
@@ -37,7 +53,33 @@ void reference_dgemm (int N, double Alpha, double* A, double* B, double* C)
 extern const char* dgemm_desc;
 extern void square_dgemm (int, double*, double*, double*);
 
-extern double wall_time();
+/* Only the parallel builds provide this; it stays NULL for the others */
+extern void dgemm_set_num_threads (int) __attribute__((weak));
+
+#pragma weak dgemm_set_strassen_cutoff
+#pragma weak dgemm_set_pages
+#pragma weak dgemm_malloc
+#pragma weak dgemm_free
+#pragma weak dgemm_kernel_name
+#pragma weak sgemm_kernel_name
+
+/* Only the libraries with the general entry point (dgemm.h) provide this */
+#pragma weak dgemm
+#pragma weak dgemm_batch
+#pragma weak dgemm_batch_strided
+#pragma weak sgemm
+#pragma weak dsgemm
+#pragma weak zgemm
+#pragma weak dgemm_pack_a
+#pragma weak dgemm_pack_b
+#pragma weak dgemm_compute_packed
+#pragma weak dgemm_compute_packed_a
+#pragma weak dgemm_packed_free
+#pragma weak sgemm_pack_a
+#pragma weak sgemm_pack_b
+#pragma weak sgemm_compute_packed
+#pragma weak sgemm_compute_packed_a
+#pragma weak sgemm_packed_free
 
 
 #include "debugMat.h"
@@ -61,12 +103,792 @@ void fill (double* p, int n)
   }
 }
 
+/* How every measurement is timed, from -W / -T / -S / -C */
+static timing_options timing;
+
+/* Counter totals over the timed samples of one measurement, -1 for the
+ * unavailable ones */
+typedef struct {
+  double total[PERF_COUNTERS];
+  double start[PERF_COUNTERS];
+} perf_span;
+
+static void perf_hook (void* ctx, int end)
+{
+  perf_span* span = (perf_span*) ctx;
+  if (!end){
+    perf_read (span->start);
+    return;
+  }
+  double now[PERF_COUNTERS];
+  perf_read (now);
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+    if (now[i] < 0)
+      span->total[i] = -1;
+    else if (span->total[i] >= 0)
+      span->total[i] += now[i] - span->start[i];
+}
+
+/* Times fn (arg) under the -W / -T / -S / -C settings. If counts isn't
+ * NULL it gets the counters per call over the timed samples. */
+void time_call (timed_fn fn, void* arg, timing_stats* stats, double* counts)
+{
+  timing_options t = timing;
+  perf_span span;
+  if (counts){
+    memset (&span, 0, sizeof(span));
+    t.sample_hook = perf_hook;
+    t.hook_ctx = &span;
+  }
+  time_trials (fn, arg, &t, stats);
+  if (counts)
+    for (int i = 0; i < PERF_COUNTERS; ++i)
+      counts[i] = span.total[i] < 0 ? -1 : span.total[i] / stats->calls;
+}
+
+/* "Gflop/s: <median>", and the spread of the samples when there are
+ * several: the 5th / 95th percentile rates and the relative stddev */
+void print_rate (double flops, const timing_stats* t)
+{
+  printf ("Gflop/s: %.3g", 1.e-9 * flops / t->median);
+  if (t->trials > 1)
+    printf ("\tp5: %.3g\tp95: %.3g\tstddev: %.2g%%", 1.e-9 * flops / t->p95, 1.e-9 * flops / t->p5,
+            100. * t->stddev / t->mean);
+}
+
+typedef struct {
+  int n;
+  double *A, *B, *C;
+} square_call;
+
+static void square_fn (void* arg)
+{
+  square_call* c = (square_call*) arg;
+  square_dgemm (c->n, c->A, c->B, c->C);
+}
+
+/* Times square_dgemm; see time_call */
+void time_dgemm (int n, double* A, double* B, double* C, timing_stats* stats, double* counts)
+{
+  square_call c = { n, A, B, C };
+  time_call (square_fn, &c, stats, counts);
+}
+
+/* -f / -P output: one record per measurement, as CSV (the run's metadata
+ * as "# key: value" lines, then a header line) or as a JSON object
+ * {"meta": {...}, "results": [...]}. gflops and seconds (per call) are the
+ * medians, gflops_p5 / gflops_p95 the spread, and samples every sample's
+ * seconds per call in the order taken (';'-separated in the CSV). error and
+ * bound are the -w check's. With -R the roofline columns follow (see
+ * roof), and with -P the counters per call; those that couldn't be opened
+ * are empty / null. benchcmp diffs two CSV runs. */
+static const char* out_format = NULL;
+static int out_json = 0;
+static int out_counters = 0;
+static int out_records = 0;
+
+/* What one record measured; threads is -t's count, 0 for the library's default */
+typedef struct {
+  const char* mode;       /* square, rect or batch */
+  const char* prec;       /* d, s, ds or z */
+  char op[8];             /* layout, then the transposes of A and B: rowNN */
+  int M, N, K, batch, threads;
+  double flops;
+  double bytes;           /* compulsory memory traffic: A and B read, C read and written */
+  double error, bound;    /* -w only, negative otherwise */
+} record;
+
+/* -R: the roofline ceilings of one core, measured at startup */
+static int roofline = 0;
+static double peak_gflops, bandwidth_gbs;
+static const char* peak_isa;
+
+/* The Gflop/s a record's problem can reach at most: the peak (twice it
+ * for float, times the threads), or its operational intensity times the
+ * bandwidth, whichever is lower. The bandwidth is one thread's, which
+ * understates what several threads can draw. */
+static double roof (const record* r, int* memory_bound)
+{
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  long threads = r->threads > 0 ? r->threads : dgemm_set_num_threads ? cpus : 1;
+  double compute = peak_gflops * (threads < cpus ? threads : cpus) * (strcmp (r->prec, "s") == 0 ? 2 : 1);
+  double memory = r->flops / r->bytes * bandwidth_gbs;
+  *memory_bound = memory < compute;
+  return memory < compute ? memory : compute;
+}
+
+/* "\tAI: <flop/byte>\tRoofline: <percent> of <ceiling> Gflop/s (compute|memory)" */
+void print_roofline (const record* r, const timing_stats* t)
+{
+  int memory_bound;
+  double ceiling = roof (r, &memory_bound);
+  printf ("\tAI: %.3g\tRoofline: %.0f%% of %.3g (%s)", r->flops / r->bytes,
+          100. * 1.e-9 * r->flops / t->median / ceiling, ceiling, memory_bound ? "memory" : "compute");
+}
+
+#ifndef BUILD_FLAGS
+#define BUILD_FLAGS "unknown"
+#endif
+
+/* A JSON string literal; NULL is null */
+static void json_string (const char* v)
+{
+  if (v == NULL){
+    printf ("null");
+    return;
+  }
+  putchar ('"');
+  for (; *v; ++v)
+    if (*v == '"' || *v == '\\')
+      printf ("\\%c", *v);
+    else if ((unsigned char) *v < 0x20)
+      printf ("\\u%04x", *v);
+    else
+      putchar (*v);
+  putchar ('"');
+}
+
+static void meta (const char* key, const char* value)
+{
+  if (out_json){
+    printf ("%s\n    \"%s\": ", out_records++ ? "," : "", key);
+    json_string (value);
+  }
+  else
+    printf ("# %s: %s\n", key, value ? value : "");
+}
+
+static void meta_num (const char* key, double value)
+{
+  if (out_json)
+    printf ("%s\n    \"%s\": %.6g", out_records++ ? "," : "", key, value);
+  else
+    printf ("# %s: %.6g\n", key, value);
+}
+
+/* "model name" from /proc/cpuinfo */
+static void cpu_model (char* model, int size)
+{
+  char line[256];
+  FILE* f = fopen ("/proc/cpuinfo", "r");
+  snprintf (model, size, "unknown");
+  if (f == NULL)
+    return;
+  while (fgets (line, sizeof(line), f))
+    if (strncmp (line, "model name", 10) == 0 && strchr (line, ':')){
+      char* v = strchr (line, ':') + 1;
+      while (*v == ' ' || *v == '\t')
+        ++v;
+      v[strcspn (v, "\n")] = 0;
+      snprintf (model, size, "%s", v);
+      break;
+    }
+  fclose (f);
+}
+
+/* The metadata, and the CSV header / the opening of the JSON results */
+void out_begin (const char* program, const char* kernel, const options* opt)
+{
+  char model[256], host[256] = "unknown", date[32];
+  time_t now = time (NULL);
+  cpu_model (model, sizeof(model));
+  gethostname (host, sizeof(host));
+  strftime (date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime (&now));
+
+  if (out_json)
+    printf ("{\n  \"meta\": {");
+  meta ("benchmark", program);
+  meta ("desc", dgemm_desc);
+  meta ("kernel", kernel);
+  meta ("build_flags", BUILD_FLAGS);
+  meta ("cpu", model);
+  meta_num ("cpus", sysconf (_SC_NPROCESSORS_ONLN));
+  meta ("host", host);
+  meta ("date", date);
+  meta_num ("warmup", opt->warmup);
+  meta_num ("trials", opt->trials);
+  meta_num ("min_time", opt->minTime);
+  meta_num ("cold", opt->cold);
+  meta_num ("affinity", opt->cpu);
+  meta_num ("strassen", opt->strassen);
+  meta_num ("prepacked", opt->prepacked);
+  meta ("placement", opt->placement);
+  meta ("pages", opt->pages);
+  if (roofline){
+    meta_num ("peak_gflops", peak_gflops);
+    meta ("peak_isa", peak_isa);
+    meta_num ("bandwidth_gbs", bandwidth_gbs);
+  }
+  out_records = 0;
+
+  if (out_json)
+    printf ("\n  },\n  \"results\": [");
+  else {
+    printf ("mode,prec,op,m,n,k,batch,threads,gflops,gflops_p5,gflops_p95,seconds,stddev,error,bound,samples");
+    if (roofline)
+      printf (",intensity,roofline_gflops,roofline_pct");
+    if (out_counters)
+      for (int i = 0; i < PERF_COUNTERS; ++i)
+        printf (",%s", perf_counter_names[i]);
+    printf ("\n");
+  }
+}
+
+void write_record (const record* r, const timing_stats* t, const double* counts)
+{
+  double Gflops_s = 1.e-9 * r->flops / t->median;
+  double p5 = 1.e-9 * r->flops / t->p95, p95 = 1.e-9 * r->flops / t->p5;
+  int memory_bound;
+  double ceiling = roofline ? roof (r, &memory_bound) : 0.0;
+  if (out_json){
+    printf ("%s\n    {\"mode\": \"%s\", \"prec\": \"%s\", \"op\": \"%s\", \"m\": %d, \"n\": %d, \"k\": %d, \"batch\": %d, \"threads\": %d, "
+            "\"gflops\": %.4g, \"gflops_p5\": %.4g, \"gflops_p95\": %.4g, \"seconds\": %.6g, \"stddev\": %.3g",
+            out_records ? "," : "", r->mode, r->prec, r->op, r->M, r->N, r->K, r->batch, r->threads,
+            Gflops_s, p5, p95, t->median, t->stddev);
+    if (r->bound >= 0)
+      printf (", \"error\": %.3g, \"bound\": %.3g", r->error, r->bound);
+    else
+      printf (", \"error\": null, \"bound\": null");
+    printf (", \"samples\": [");
+    for (int i = 0; i < t->trials; ++i)
+      printf ("%s%.6g", i ? ", " : "", t->samples[i]);
+    printf ("]");
+    if (roofline)
+      printf (", \"intensity\": %.4g, \"roofline_gflops\": %.4g, \"roofline_pct\": %.3g",
+              r->flops / r->bytes, ceiling, 100. * Gflops_s / ceiling);
+    for (int i = 0; out_counters && i < PERF_COUNTERS; ++i)
+      if (counts[i] >= 0)
+        printf (", \"%s\": %.0f", perf_counter_names[i], counts[i]);
+      else
+        printf (", \"%s\": null", perf_counter_names[i]);
+    printf ("}");
+  }
+  else {
+    printf ("%s,%s,%s,%d,%d,%d,%d,%d,%.4g,%.4g,%.4g,%.6g,%.3g,", r->mode, r->prec, r->op, r->M, r->N, r->K,
+            r->batch, r->threads, Gflops_s, p5, p95, t->median, t->stddev);
+    if (r->bound >= 0)
+      printf ("%.3g,%.3g,", r->error, r->bound);
+    else
+      printf (",,");
+    for (int i = 0; i < t->trials; ++i)
+      printf ("%s%.6g", i ? ";" : "", t->samples[i]);
+    if (roofline)
+      printf (",%.4g,%.4g,%.3g", r->flops / r->bytes, ceiling, 100. * Gflops_s / ceiling);
+    for (int i = 0; out_counters && i < PERF_COUNTERS; ++i)
+      if (counts[i] >= 0)
+        printf (",%.0f", counts[i]);
+      else
+        printf (",");
+    printf ("\n");
+  }
+  ++out_records;
+  fflush (stdout);
+}
+
+void out_finish (void)
+{
+  if (out_json)
+    printf (out_records ? "\n  ]\n}\n" : "]\n}\n");
+}
+
 void absolute_value (double *p, int n)
 {
   for (int i = 0; i < n; ++i)
     p[i] = fabs (p[i]);
 }
 
+double max_abs (const double* p, int n)
+{
+  double m = 0.0;
+  for (int i = 0; i < n; ++i)
+    if (fabs (p[i]) > m)
+      m = fabs (p[i]);
+  return m;
+}
+
+/* Ensures that square_dgemm's error does not exceed the theoretical error
+ * bound for A * B, on copies, so A and B are left as they are */
+void check_square (int n, const double* A0, const double* B0)
+{
+  double* A = (double*) malloc (3 * (size_t) n * n * sizeof(double));
+  if (A == NULL)
+    Fail ("Failed to allocate check");
+  double* B = A + n * n;
+  double* C = B + n * n;
+  memcpy (A, A0, n * n * sizeof(double));
+  memcpy (B, B0, n * n * sizeof(double));
+
+  /* C := A * B, computed with square_dgemm */
+  memset (C, 0, n * n * sizeof(double));
+  square_dgemm (n, A, B, C);
+
+  /* Do not explicitly check that A and B were unmodified on square_dgemm exit
+  *  - if they were, the following will most likely detect it:
+  * C := C - A * B, computed with reference_dgemm */
+  reference_dgemm(n, -1., A, B, C);
+
+  /* A := |A|, B := |B|, C := |C| */
+  absolute_value (A, n * n);
+  absolute_value (B, n * n);
+  absolute_value (C, n * n);
+
+  /* C := |C| - 3 * e_mach * n * |A| * |B|, computed with reference_dgemm */
+  reference_dgemm (n, -3.*DBL_EPSILON*n, A, B, C);
+
+  /* If any element in C is positive, then something went wrong in square_dgemm */
+  for (int i = 0; i < n * n; ++i)
+    if (C[i] > 0)
+      Fail("*** FAILURE *** Error in matrix multiply exceeds componentwise error bounds.\n" );
+  free (A);
+}
+
+typedef struct {
+  int n;
+  const double *A, *B;
+} check_call;
+
+static void* check_fn (void* arg)
+{
+  check_call* c = (check_call*) arg;
+  check_square (c->n, c->A, c->B);
+  return NULL;
+}
+
+/* check_square on this thread and another one at the same time: with a
+ * parallel library one of them has the pool and the other must run on
+ * its own thread, without either disturbing the other */
+void check_concurrent (int n, const double* A, const double* B)
+{
+  check_call c = { n, A, B };
+  pthread_t t;
+  if (pthread_create (&t, NULL, check_fn, &c) != 0)
+    Fail ("Failed to start the check thread");
+  check_square (n, A, B);
+  pthread_join (t, NULL);
+}
+
+/* Normwise error bound of Strassen-Winograd with this cutoff, as a
+ * multiple of max|A| * max|B|: Higham, "Accuracy and Stability of
+ * Numerical Algorithms", Theorem 23.3, for k levels of recursion down to
+ * n0 (the same halving as square_dgemm), with e_mach for the unit
+ * roundoff to leave room for the remainder rows of odd sizes */
+double strassen_bound (int n, int cutoff)
+{
+  int n0 = n;
+  double levels = 1.0;
+  while (n0 > cutoff){
+    n0 /= 2;
+    levels *= 18.0;
+  }
+  return (levels * ((double) n0 * n0 + 6. * n0) - 6. * n) * DBL_EPSILON;
+}
+
+/* Allocates the matrices of the square sizes. By default malloc's pages
+ * land wherever the thread filling them runs, i.e. all on one node. -m
+ * places them interleaved over all nodes, on the node the benchmark runs
+ * on (local), or on another one (remote); the benchmark's thread is kept
+ * on its node for the latter two, and the NUMA builds start the pool there.
+ * -H allocates them with dgemm_malloc instead, on the pages it picked. */
+double* alloc_matrices (size_t bytes, const char* placement, const char* pages)
+{
+  if (pages != NULL)
+    return (double*) dgemm_malloc (bytes);
+  if (placement == NULL)
+    return (double*) malloc (bytes);
+#ifdef NUMA
+  if (numa_available () < 0){
+    fprintf (stderr, "-m: no NUMA support in this kernel\n");
+    exit (EXIT_FAILURE);
+  }
+  if (strcmp (placement, "interleave") == 0)
+    return (double*) numa_alloc_interleaved (bytes);
+
+  int local = numa_node_of_cpu (sched_getcpu ());
+  numa_run_on_node (local);
+  int node = local;
+  if (strcmp (placement, "remote") == 0){
+    for (int i = 1; i <= numa_max_node () && node == local; ++i){
+      int other = (local + i) % (numa_max_node () + 1);
+      long long free_bytes;
+      if (numa_node_size64 (other, &free_bytes) > 0)
+        node = other;
+    }
+    if (node == local)
+      fprintf (stderr, "-m remote: only one node with memory, placing locally\n");
+  }
+  else if (strcmp (placement, "local") != 0){
+    fprintf (stderr, "-m %s: expected interleave, local or remote\n", placement);
+    exit (EXIT_FAILURE);
+  }
+  return (double*) numa_alloc_onnode (bytes, node);
+#else
+  fprintf (stderr, "-m needs a numa=1 build\n");
+  exit (EXIT_FAILURE);
+#endif
+}
+
+void free_matrices (double* p, size_t bytes, const char* placement, const char* pages)
+{
+  if (pages != NULL){
+    dgemm_free (p);
+    return;
+  }
+#ifdef NUMA
+  if (placement != NULL){
+    numa_free (p, bytes);
+    return;
+  }
+#else
+  (void) bytes;
+  (void) placement;
+#endif
+  free (p);
+}
+
+/* Element types of -p: dgemm, sgemm, dsgemm (float in, double out), zgemm */
+enum precision { PrecD, PrecS, PrecDS, PrecZ };
+static const char* prec_names[] = { "d", "s", "ds", "z" };
+
+/* One problem of the rectangular sweep; alpha_i / beta_i are the imaginary
+ * parts for zgemm */
+typedef struct {
+  enum precision prec;
+  enum dgemm_layout layout;
+  enum dgemm_transpose transA, transB;
+  int M, N, K;
+  double alpha, beta;
+  double alpha_i, beta_i;
+  int packed;     /* -K: 1 with B fixed and prepacked (dgemm_pack_b), 2 with A */
+  int ld;         /* leading dimension of every operand, 0 for padded ones,
+                   * -1 for the row (column) length */
+} shape;
+
+/* Rows x cols of a stored operand, given its layout */
+static int ld_of (const shape* s, int rows, int cols)
+{
+  int n = s->layout == DgemmRowMajor ? cols : rows;
+  if (s->ld != 0)
+    return s->ld > 0 ? s->ld : n;
+  /* Padded so the leading dimension is never the row length */
+  return n + 3;
+}
+
+/* Operands of one shape: the double (or complex) copies the reference
+ * runs on, and the float ones sgemm / dsgemm read */
+typedef struct {
+  int lda, ldb, ldc;
+  double *A, *B, *C;
+  float *Af, *Bf, *Cf;
+  void* P;        /* the prepacked operand, see shape.packed */
+} operands;
+
+/* Packs the operand s keeps fixed, with alpha; dgemm_packed_free or
+ * sgemm_packed_free frees it */
+static void* pack_fixed (const shape* s, const operands* o)
+{
+  if (s->prec == PrecS)
+    return s->packed == 1 ? (void*) sgemm_pack_b (s->layout, s->transB, s->K, s->N, s->alpha, o->Bf, o->ldb)
+                          : (void*) sgemm_pack_a (s->layout, s->transA, s->M, s->K, s->alpha, o->Af, o->lda);
+  return s->packed == 1 ? (void*) dgemm_pack_b (s->layout, s->transB, s->K, s->N, s->alpha, o->B, o->ldb)
+                        : (void*) dgemm_pack_a (s->layout, s->transA, s->M, s->K, s->alpha, o->A, o->lda);
+}
+
+/* C := alpha * op(A) * op(B) + beta * C through the routine under test */
+static void call_gemm (const shape* s, operands* o)
+{
+  double alpha[2] = { s->alpha, s->alpha_i };
+  double beta[2] = { s->beta, s->beta_i };
+  switch (s->prec){
+    case PrecD:
+      if (s->packed == 1)
+        dgemm_compute_packed (s->layout, s->transA, s->M, o->A, o->lda, o->P, s->beta, o->C, o->ldc);
+      else if (s->packed == 2)
+        dgemm_compute_packed_a (s->layout, o->P, s->transB, s->N, o->B, o->ldb, s->beta, o->C, o->ldc);
+      else
+        dgemm (s->layout, s->transA, s->transB, s->M, s->N, s->K, s->alpha, o->A, o->lda, o->B, o->ldb, s->beta, o->C, o->ldc);
+      break;
+    case PrecS:
+      if (s->packed == 1)
+        sgemm_compute_packed (s->layout, s->transA, s->M, o->Af, o->lda, o->P, s->beta, o->Cf, o->ldc);
+      else if (s->packed == 2)
+        sgemm_compute_packed_a (s->layout, o->P, s->transB, s->N, o->Bf, o->ldb, s->beta, o->Cf, o->ldc);
+      else
+        sgemm (s->layout, s->transA, s->transB, s->M, s->N, s->K, s->alpha, o->Af, o->lda, o->Bf, o->ldb, s->beta, o->Cf, o->ldc);
+      break;
+    case PrecDS:
+      dsgemm (s->layout, s->transA, s->transB, s->M, s->N, s->K, s->alpha, o->Af, o->lda, o->Bf, o->ldb, s->beta, o->C, o->ldc);
+      break;
+    case PrecZ:
+      zgemm (s->layout, s->transA, s->transB, s->M, s->N, s->K, alpha, o->A, o->lda, o->B, o->ldb, beta, o->C, o->ldc);
+      break;
+  }
+}
+
+/* |re| + |im|, as BLAS's dcabs1; it bounds the modulus */
+static double cabs1 (double re, double im)
+{
+  return fabs (re) + fabs (im);
+}
+
+static void to_float (float* dst, const double* src, int n)
+{
+  for (int i = 0; i < n; ++i)
+    dst[i] = (float) src[i];
+}
+
+typedef struct {
+  const shape* s;
+  operands* o;
+} shape_call;
+
+static void shape_fn (void* arg)
+{
+  shape_call* c = (shape_call*) arg;
+  call_gemm (c->s, c->o);
+}
+
+/* Times and checks one shape against cblas_dgemm (cblas_zgemm for zgemm).
+ * The float operands are rounded first, so the reference sees the same
+ * inputs; sgemm is held to the float epsilon. mode and threads are for
+ * the record. */
+void run_shape (const shape* s, const char* mode, int threads, int noCheck)
+{
+  int rowsA = s->transA == DgemmNoTrans ? s->M : s->K;
+  int colsA = s->transA == DgemmNoTrans ? s->K : s->M;
+  int rowsB = s->transB == DgemmNoTrans ? s->K : s->N;
+  int colsB = s->transB == DgemmNoTrans ? s->N : s->K;
+  operands o;
+  o.lda = ld_of (s, rowsA, colsA);
+  o.ldb = ld_of (s, rowsB, colsB);
+  o.ldc = ld_of (s, s->M, s->N);
+  int sizeA = o.lda * (s->layout == DgemmRowMajor ? rowsA : colsA);
+  int sizeB = o.ldb * (s->layout == DgemmRowMajor ? rowsB : colsB);
+  int sizeC = o.ldc * (s->layout == DgemmRowMajor ? s->M : s->N);
+  /* doubles per element */
+  int w = s->prec == PrecZ ? 2 : 1;
+
+  double* A = (double*) malloc (w * (sizeA + sizeB + 3 * sizeC) * sizeof(double));
+  float* Af = (float*) malloc ((sizeA + sizeB + sizeC) * sizeof(float));
+  if (A == NULL || Af == NULL)
+    Fail ("Failed to allocate matrix");
+  double* B = A + w * sizeA;
+  double* C = B + w * sizeB;
+  double* C0 = C + w * sizeC;
+  double* R = C0 + w * sizeC;
+  o.A = A;
+  o.B = B;
+  o.C = C;
+  o.Af = Af;
+  o.Bf = Af + sizeA;
+  o.Cf = o.Bf + sizeB;
+
+  fill (A, w * sizeA);
+  fill (B, w * sizeB);
+  fill (C0, w * sizeC);
+  if (s->prec == PrecS || s->prec == PrecDS){
+    to_float (o.Af, A, sizeA);
+    to_float (o.Bf, B, sizeB);
+    to_float (o.Cf, C0, sizeC);
+    for (int i = 0; i < sizeA; ++i) A[i] = o.Af[i];
+    for (int i = 0; i < sizeB; ++i) B[i] = o.Bf[i];
+    for (int i = 0; i < sizeC; ++i) C0[i] = o.Cf[i];
+  }
+  memcpy (C, C0, w * sizeC * sizeof(double));
+
+  /* The fixed operand is packed once, outside the timing */
+  o.P = NULL;
+  if (s->packed && (o.P = pack_fixed (s, &o)) == NULL)
+    Fail ("Failed to pack operand");
+
+  shape_call c = { s, &o };
+  timing_stats t;
+  double counts[PERF_COUNTERS];
+  record r = { mode, prec_names[s->prec], "", s->M, s->N, s->K, 0, threads, 2. * w * w * s->M * s->N * s->K, 0.0, -1., -1. };
+  /* Bytes per element of A and B, and of C */
+  int eAB = s->prec == PrecS || s->prec == PrecDS ? 4 : 8 * w;
+  int eC = s->prec == PrecS ? 4 : 8 * w;
+  r.bytes = eAB * ((double) s->M * s->K + (double) s->K * s->N) + 2. * eC * s->M * s->N;
+  snprintf (r.op, sizeof(r.op), "%s%s%s", s->layout == DgemmRowMajor ? "row" : "col",
+            s->transA == DgemmNoTrans ? "N" : s->transA == DgemmTrans ? "T" : "C",
+            s->transB == DgemmNoTrans ? "N" : s->transB == DgemmTrans ? "T" : "C");
+  time_call (shape_fn, &c, &t, out_counters ? counts : NULL);
+  if (out_format)
+    write_record (&r, &t, counts);
+  else {
+    printf ("M: %d\tN: %d\tK: %d\t%s\t%s\t", s->M, s->N, s->K, r.op, r.prec);
+    print_rate (r.flops, &t);
+    if (roofline)
+      print_roofline (&r, &t);
+    printf ("\n");
+  }
+
+  if (!noCheck){
+    enum CBLAS_ORDER layout = (enum CBLAS_ORDER) s->layout;
+    enum CBLAS_TRANSPOSE transA = (enum CBLAS_TRANSPOSE) s->transA;
+    enum CBLAS_TRANSPOSE transB = (enum CBLAS_TRANSPOSE) s->transB;
+
+    /* C := alpha * op(A) * op(B) + beta * C0, once with each library */
+    memcpy (C, C0, w * sizeC * sizeof(double));
+    memcpy (R, C0, w * sizeC * sizeof(double));
+    if (s->prec == PrecS)
+      to_float (o.Cf, C0, sizeC);
+    call_gemm (s, &o);
+    if (s->prec == PrecS)
+      for (int i = 0; i < sizeC; ++i)
+        C[i] = o.Cf[i];
+    if (s->prec == PrecZ){
+      double alpha[2] = { s->alpha, s->alpha_i };
+      double beta[2] = { s->beta, s->beta_i };
+      cblas_zgemm (layout, transA, transB, s->M, s->N, s->K, alpha, A, o.lda, B, o.ldb, beta, R, o.ldc);
+    }
+    else
+      cblas_dgemm (layout, transA, transB, s->M, s->N, s->K, s->alpha, A, o.lda, B, o.ldb, s->beta, R, o.ldc);
+
+    /* R := |C - R| per real component, then bound it by
+     * c * e_mach * (K + 2) * (|alpha| |A| |B| + |beta| |C0|) per element,
+     * with c = 3 (6 for the complex multiplies) and |.| the absolute
+     * value, cabs1 for complex */
+    for (int i = 0; i < w * sizeC; ++i)
+      R[i] = fabs (C[i] - R[i]);
+    double* bound = C;
+    for (int i = 0; i < sizeA; ++i)
+      A[i] = w == 2 ? cabs1 (A[2 * i], A[2 * i + 1]) : fabs (A[i]);
+    for (int i = 0; i < sizeB; ++i)
+      B[i] = w == 2 ? cabs1 (B[2 * i], B[2 * i + 1]) : fabs (B[i]);
+    for (int i = 0; i < sizeC; ++i)
+      bound[i] = w == 2 ? cabs1 (C0[2 * i], C0[2 * i + 1]) : fabs (C0[i]);
+    double e = (w == 2 ? 6. : 3.) * (s->prec == PrecS ? FLT_EPSILON : DBL_EPSILON) * (s->K + 2);
+    cblas_dgemm (layout, transA == CblasConjTrans ? CblasTrans : transA, transB == CblasConjTrans ? CblasTrans : transB,
+                 s->M, s->N, s->K, e * cabs1 (s->alpha, s->alpha_i), A, o.lda, B, o.ldb, e * cabs1 (s->beta, s->beta_i), bound, o.ldc);
+    for (int i = 0; i < w * sizeC; ++i)
+      if (R[i] > bound[i / w])
+        Fail("*** FAILURE *** Error in matrix multiply exceeds componentwise error bounds.\n" );
+  }
+
+  if (o.P != NULL){
+    if (s->prec == PrecS)
+      sgemm_packed_free (o.P);
+    else
+      dgemm_packed_free (o.P);
+  }
+  free (Af);
+  free (A);
+}
+
+/* Tall, wide, skinny-K and fat-K problems under every layout / transpose;
+ * zgemm gets complex scalars and conjugate transposes for every other shape.
+ * With prepacked, every other shape keeps B prepacked and the rest A.
+ * The last shapes store the operands tightly, then with one power-of-two
+ * leading dimension, so plan_packing picks the contiguous packing loops and
+ * the skewed C_padded */
+void rect_sweep (enum precision prec, int threads, int noCheck, int prepacked)
+{
+  int dims[][4] = { {1, 1, 1}, {7, 5, 3}, {64, 64, 1}, {1, 500, 500}, {500, 1, 500}, {500, 500, 1},
+                    {1000, 40, 40}, {40, 1000, 40}, {40, 40, 1000}, {300, 200, 100}, {257, 129, 65},
+                    {1000, 1000, 64}, {64, 1000, 1000}, {1000, 64, 1000}, {513, 511, 1025},
+                    {200, 300, 100, -1}, {511, 257, 513, -1}, {512, 256, 1024, -1},
+                    {300, 200, 128, 512}, {512, 512, 512, 512}, {257, 511, 129, 1024},
+                    {1000, 1000, 96, 1024}, {96, 1000, 1000, 1024} };
+  double scalars[][2] = { {1.0, 1.0}, {-0.5, 0.0}, {2.0, 0.25} };
+  int ndims = sizeof(dims)/sizeof(dims[0]);
+
+  for (int d = 0; d < ndims; ++d)
+    for (int v = 0; v < 8; ++v){
+      enum dgemm_transpose t[] = { DgemmNoTrans, prec == PrecZ && d % 2 ? DgemmConjTrans : DgemmTrans };
+      shape s;
+      s.prec = prec;
+      s.layout = (v & 4) ? DgemmColMajor : DgemmRowMajor;
+      s.transA = t[v & 1];
+      s.transB = t[(v >> 1) & 1];
+      s.M = dims[d][0];
+      s.N = dims[d][1];
+      s.K = dims[d][2];
+      s.alpha = scalars[(d + v) % 3][0];
+      s.beta = scalars[(d + v) % 3][1];
+      s.alpha_i = prec == PrecZ ? 0.5 : 0.0;
+      s.beta_i = prec == PrecZ && s.beta != 0.0 ? -0.25 : 0.0;
+      s.packed = prepacked ? 1 + d % 2 : 0;
+      s.ld = dims[d][3];
+      run_shape (&s, "rect", threads, noCheck);
+    }
+}
+
+typedef struct {
+  int n, batch;
+  const double **A, **B;
+  double **C;
+} batch_call;
+
+static void batch_fn (void* arg)
+{
+  batch_call* c = (batch_call*) arg;
+  dgemm_batch (DgemmRowMajor, DgemmNoTrans, DgemmNoTrans, c->n, c->n, c->n, 1.0, c->A, c->n, c->B, c->n, 1.0, c->C, c->n, c->batch);
+}
+
+/* Times dgemm_batch on batch independent n x n problems, at the aggregate
+ * Gflop/s. The correctness check goes through dgemm_batch_strided. */
+void run_batch (int n, int batch, int threads, int noCheck)
+{
+  long nn = (long) n * n;
+  double* buf = (double*) malloc (3 * nn * batch * sizeof(double));
+  const double** Ap = (const double**) malloc (batch * sizeof(double*));
+  const double** Bp = (const double**) malloc (batch * sizeof(double*));
+  double** Cp = (double**) malloc (batch * sizeof(double*));
+  if (buf == NULL || Ap == NULL || Bp == NULL || Cp == NULL)
+    Fail ("Failed to allocate batch");
+
+  double* A = buf;
+  double* B = A + nn * batch;
+  double* C = B + nn * batch;
+  fill (A, nn * batch);
+  fill (B, nn * batch);
+  fill (C, nn * batch);
+  for (int i = 0; i < batch; ++i){
+    Ap[i] = A + i * nn;
+    Bp[i] = B + i * nn;
+    Cp[i] = C + i * nn;
+  }
+
+  batch_call c = { n, batch, Ap, Bp, Cp };
+  timing_stats t;
+  double counts[PERF_COUNTERS];
+  record r = { "batch", "d", "rowNN", n, n, n, batch, threads, 2. * batch * nn * n, 32. * batch * nn, -1., -1. };
+  time_call (batch_fn, &c, &t, out_counters ? counts : NULL);
+  if (out_format)
+    write_record (&r, &t, counts);
+  else {
+    printf ("Size: %d\tBatch: %d\t", n, batch);
+    print_rate (r.flops, &t);
+    if (roofline)
+      print_roofline (&r, &t);
+    printf ("\n");
+  }
+
+  if (!noCheck){
+    /* Same check as the square sizes, item by item */
+    memset (C, 0, nn * batch * sizeof(double));
+    dgemm_batch_strided (DgemmRowMajor, DgemmNoTrans, DgemmNoTrans, n, n, n, 1.0, A, n, nn, B, n, nn, 1.0, C, n, nn, batch);
+    for (int i = 0; i < batch; ++i){
+      double* Ai = A + i * nn;
+      double* Bi = B + i * nn;
+      double* Ci = C + i * nn;
+      reference_dgemm (n, -1., Ai, Bi, Ci);
+      absolute_value (Ai, nn);
+      absolute_value (Bi, nn);
+      absolute_value (Ci, nn);
+      reference_dgemm (n, -3.*DBL_EPSILON*n, Ai, Bi, Ci);
+      for (int j = 0; j < nn; ++j)
+        if (Ci[j] > 0)
+          Fail("*** FAILURE *** Error in matrix multiply exceeds componentwise error bounds.\n" );
+    }
+  }
+
+  free (Cp);
+  free (Bp);
+  free (Ap);
+  free (buf);
+}
+
 /* The benchmarking program */
 int main (int argc, char **argv)
 {
@@ -74,9 +896,136 @@ int main (int argc, char **argv)
 //  freopen("result.txt", "w", stdout);
 //  printf ("Description:\t%s\n\n", dgemm_desc);
   /* We can pick just one size with the -n flag */
-  int n0;
-  int noCheck;
-  cmdLine(argc,argv,&n0,&noCheck);
+  options opt;
+  cmdLine(argc,argv,&opt);
+  int n0 = opt.n;
+  int noCheck = opt.noCheck;
+  int nThreads = opt.nThreads;
+  int rect = opt.rect;
+  int batch = opt.batch;
+  int prepacked = opt.prepacked;
+  const char* prec_name = opt.prec;
+  int strassen = opt.strassen;
+  const char* placement = opt.placement;
+  const char* pages = opt.pages;
+  out_format = opt.format ? opt.format : opt.perf;
+  out_counters = opt.perf != NULL;
+
+  timing.warmup = opt.warmup;
+  timing.trials = opt.trials;
+  timing.min_time = opt.minTime;
+  timing.cold = opt.cold;
+  if (opt.cpu >= 0 && pin_to_cpu (opt.cpu) != 0){
+    fprintf (stderr, "-a %d: ", opt.cpu);
+    Fail ("can't pin to that cpu");
+  }
+
+  enum precision prec = PrecD;
+  while (prec <= PrecZ && strcmp (prec_name, prec_names[prec]) != 0)
+    ++prec;
+  void* entry[] = { (void*) dgemm, (void*) sgemm, (void*) dsgemm, (void*) zgemm };
+  /* The default square dgemm sizes only need square_dgemm */
+  if (prec > PrecZ || (prec != PrecD && entry[prec] == NULL)){
+    fprintf (stderr, "-p %s needs a library with %sgemm\n", prec_name, prec_name);
+    exit (EXIT_FAILURE);
+  }
+
+  roofline = opt.roofline;
+  if (roofline){
+    peak_gflops = roofline_peak_gflops (&peak_isa);
+    bandwidth_gbs = roofline_bandwidth_gbs ();
+    if (out_format == NULL)
+      printf ("Peak: %.3g Gflop/s (%s FMA, one core)\tBandwidth: %.3g GB/s (triad, one thread)\n",
+              peak_gflops, peak_isa, bandwidth_gbs);
+  }
+
+  if (out_format != NULL){
+    if (strcmp (out_format, "csv") != 0 && strcmp (out_format, "json") != 0){
+      fprintf (stderr, "-f / -P %s: expected csv or json\n", out_format);
+      exit (EXIT_FAILURE);
+    }
+    if (opt.perf && opt.format && strcmp (opt.perf, opt.format) != 0){
+      fprintf (stderr, "-P %s and -f %s disagree on the format\n", opt.perf, opt.format);
+      exit (EXIT_FAILURE);
+    }
+    out_json = strcmp (out_format, "json") == 0;
+    /* Before the first multiply, so the pool's workers inherit the counters */
+    if (out_counters && perf_open () < PERF_COUNTERS)
+      fprintf (stderr, "-P: some counters are unavailable here (no PMU, or perf_event_paranoid)\n");
+    const char* (*kernel_name) (void) = prec == PrecS ? sgemm_kernel_name : dgemm_kernel_name;
+    out_begin (argv[0], kernel_name ? kernel_name () : NULL, &opt);
+  }
+
+  if (pages != NULL){
+    const char* page_names[] = { "small", "thp", "huge" };
+    int mode = 0;
+    while (mode < 3 && strcmp (pages, page_names[mode]) != 0)
+      ++mode;
+    if (mode == 3 || dgemm_set_pages == NULL || placement != NULL){
+      fprintf (stderr, "-H small|thp|huge needs a library with dgemm_set_pages, and no -m\n");
+      exit (EXIT_FAILURE);
+    }
+    dgemm_set_pages ((enum dgemm_pages) mode);
+  }
+
+  if (strassen){
+    if (prec != PrecD || rect || batch > 0 || prepacked || dgemm_set_strassen_cutoff == NULL){
+      fprintf (stderr, "-w needs a library with dgemm_set_strassen_cutoff, and runs square_dgemm only\n");
+      exit (EXIT_FAILURE);
+    }
+    if (dgemm_set_strassen_cutoff (strassen) != 0){
+      fprintf (stderr, "-w %d: cutoff out of range\n", strassen);
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  if (nThreads > 0 && dgemm_set_num_threads == NULL){
+    fprintf (stderr, "-t needs a parallel build, e.g. benchmark-blocked-parallel\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (batch > 0){
+    if (prec != PrecD){
+      fprintf (stderr, "-b only runs dgemm_batch\n");
+      exit (EXIT_FAILURE);
+    }
+    if (dgemm_batch == NULL){
+      fprintf (stderr, "-b needs a library with dgemm_batch\n");
+      exit (EXIT_FAILURE);
+    }
+    /* The small sizes batches are meant for, unless -n picks one */
+    int batch_sizes[] = {4, 8, 16, 24, 32, 48, 64};
+    int nbatch_sizes = sizeof(batch_sizes)/sizeof(batch_sizes[0]);
+    if (n0){
+      batch_sizes[0] = n0;
+      nbatch_sizes = 1;
+    }
+    for (int i = 0; i < nbatch_sizes; ++i){
+      if (nThreads > 0)
+        dgemm_set_num_threads (nThreads);
+      run_batch (batch_sizes[i], batch, nThreads, noCheck);
+    }
+    out_finish ();
+    return 0;
+  }
+
+  if (prepacked){
+    void* pack[] = { (void*) dgemm_pack_b, (void*) sgemm_pack_b };
+    if (prec > PrecS || pack[prec] == NULL){
+      fprintf (stderr, "-K needs a library with %sgemm_pack_b, and runs -p d or s only\n", prec_name);
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  if (rect){
+    if (dgemm == NULL){
+      fprintf (stderr, "-r needs a library with the general dgemm entry point\n");
+      exit (EXIT_FAILURE);
+    }
+    rect_sweep (prec, nThreads, noCheck, prepacked);
+    out_finish ();
+    return 0;
+  }
 
   /* Test sizes should highlight performance dips at multiples of certain powers-of-two */
 
@@ -110,7 +1059,8 @@ int main (int argc, char **argv)
 
   /* allocate memory for all problems */
   double* buf = NULL;
-  buf = (double*) malloc (3 * nmax * nmax * sizeof(double));
+  size_t buf_bytes = 3 * (size_t) nmax * nmax * sizeof(double);
+  buf = alloc_matrices (buf_bytes, placement, pages);
   if (buf == NULL){
     if (n0){
       Fail ("Failed to allocate matrix");
@@ -130,6 +1080,16 @@ int main (int argc, char **argv)
     /* Create and fill 3 random matrices A,B,C*/
     int n = test_sizes[isize];
 
+    if (prec != PrecD || prepacked){
+      /* The other element types go through their general entry points,
+       * -K through the packed ones */
+      shape s = { prec, DgemmRowMajor, DgemmNoTrans, DgemmNoTrans, n, n, n, 1.0, 1.0, 0.0, 0.0, prepacked, 0 };
+      if (nThreads > 0)
+        dgemm_set_num_threads (nThreads);
+      run_shape (&s, "square", nThreads, noCheck);
+      continue;
+    }
+
     double* A = buf + 0;
     double* B = A + nmax*nmax;
     double* C = B + nmax*nmax;
@@ -138,55 +1098,78 @@ int main (int argc, char **argv)
     fill (B, n*n);
     fill (C, n*n);
 
-    /* Measure performance (in Gflops/s). */
-
-    /* Time a "sufficiently long" sequence of calls to reduce noise */
-    double Gflops_s, seconds = -1.0;
-    double timeout = 0.1; // "sufficiently long" := at least 1/10 second.
-    for (int n_iterations = 1; seconds < timeout; n_iterations *= 2)
-    {
-      /* Warm-up */
-      square_dgemm (n, A, B, C);
-
-      /* Benchmark n_iterations runs of square_dgemm */
-      seconds = -wall_time();
-      for (int it = 0; it < n_iterations; ++it)
+    /* Relaxed check for -w, ahead of the timing so the records carry it:
+     * Strassen-Winograd only meets a normwise bound, so report
+     * max|C - A * B| / (max|A| * max|B|) against it */
+    double error = -1., bound = -1.;
+    if (strassen){
+      bound = strassen_bound (n, strassen);
+      error = 0.0;
+      if (!noCheck){
+        memset (C, 0, n * n * sizeof(double));
         square_dgemm (n, A, B, C);
-      seconds += wall_time();
-
-      /*  compute Mflop/s rate */
-      Gflops_s = 2.e-9 * n_iterations * n * n * n / seconds;
+        reference_dgemm (n, -1., A, B, C);
+        error = max_abs (C, n * n) / (max_abs (A, n * n) * max_abs (B, n * n));
+        fill (C, n * n);
+      }
     }
-    printf ("Size: %d\tGflop/s: %.3g\n", n, Gflops_s);
-
-    if (!noCheck){
-      /* Ensure that error does not exceed the theoretical error bound. */
-
-      /* C := A * B, computed with square_dgemm */
-      memset (C, 0, n * n * sizeof(double));
-      square_dgemm (n, A, B, C);
 
-      /* Do not explicitly check that A and B were unmodified on square_dgemm exit
-      *  - if they were, the following will most likely detect it:
-      * C := C - A * B, computed with reference_dgemm */
-      reference_dgemm(n, -1., A, B, C);
-
-      /* A := |A|, B := |B|, C := |C| */
-      absolute_value (A, n * n);
-      absolute_value (B, n * n);
-      absolute_value (C, n * n);
-
-      /* C := |C| - 3 * e_mach * n * |A| * |B|, computed with reference_dgemm */
-      reference_dgemm (n, -3.*DBL_EPSILON*n, A, B, C);
+    /* Measure performance (in Gflops/s). With -w an effective rate: the
+     * 2n^3 of the classical algorithm over the time taken */
+    record r = { "square", "d", "rowNN", n, n, n, 0, nThreads, 2. * n * n * n, 32. * n * n, error, bound };
+    timing_stats t;
+    double counts[PERF_COUNTERS];
+    if (nThreads > 0){
+      /* Scaling sweep: 1, 2, 4, ... threads, always ending at nThreads.
+       * Each thread count restarts the pool, so the first calls after it
+       * are the ones checked, two at once */
+      for (int p = 1; ; p = (p * 2 < nThreads) ? p * 2 : nThreads){
+        dgemm_set_num_threads (p);
+        if (!noCheck && !strassen)
+          check_concurrent (n, A, B);
+        time_dgemm (n, A, B, C, &t, out_counters ? counts : NULL);
+        r.threads = p;
+        if (out_format)
+          write_record (&r, &t, counts);
+        else {
+          printf ("Size: %d\tThreads: %d\t", n, p);
+          print_rate (r.flops, &t);
+          if (roofline)
+            print_roofline (&r, &t);
+          printf ("\n");
+        }
+        if (p == nThreads)
+          break;
+      }
+      if (strassen && !out_format)
+        printf ("Size: %d", n);
+    }
+    else {
+      time_dgemm (n, A, B, C, &t, out_counters ? counts : NULL);
+      if (out_format)
+        write_record (&r, &t, counts);
+      else {
+        printf ("Size: %d\t", n);
+        print_rate (r.flops, &t);
+        if (roofline)
+          print_roofline (&r, &t);
+        if (!strassen)
+          printf ("\n");
+      }
+    }
 
-      /* If any element in C is positive, then something went wrong in square_dgemm */
-      for (int i = 0; i < n * n; ++i)
-        if (C[i] > 0)
-          Fail("*** FAILURE *** Error in matrix multiply exceeds componentwise error bounds.\n" );
+    if (strassen){
+      if (!out_format)
+        printf ("\tError: %.3g\tBound: %.3g\n", error, bound);
+      if (error > bound)
+        Fail("*** FAILURE *** Error in matrix multiply exceeds normwise Strassen error bound.\n" );
     }
+    else if (!noCheck && nThreads == 0)
+      check_square (n, A, B);
   }
 
-  free (buf);
+  free_matrices (buf, buf_bytes, placement, pages);
+  out_finish ();
 //  fclose(stdout);
 
   return 0;
@@ -0,0 +1,165 @@
+/*
+ *  Cache topology of the host, for deriving block sizes.
+ *
+ *  Linux exposes every cache of cpu0 under
+ *  /sys/devices/system/cpu/cpu0/cache/index<i>/; CPUID leaf 4 (Intel) or
+ *  0x8000001D (AMD) describes the same caches where sysfs is missing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "cache-info.h"
+
+#define SYSFS_CACHE "/sys/devices/system/cpu/cpu0/cache/index%d/%s"
+
+static cache_topology topology;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+
+// Stores a level / data-or-unified cache into its slot of t
+static void record(cache_topology* t, int level, const cache_level* c) {
+    if (level == 1)
+        t->l1d = *c;
+    else if (level == 2)
+        t->l2 = *c;
+    else if (level == 3)
+        t->l3 = *c;
+}
+
+
+static int read_sysfs(int index, const char* name, char* buf, int len) {
+    char path[128];
+    snprintf(path, sizeof(path), SYSFS_CACHE, index, name);
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return 0;
+    int ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return ok;
+}
+
+
+// Counts the CPUs in a list like "0-3,8-11"
+static int count_cpus(const char* list) {
+    int n = 0;
+    while (*list) {
+        char* end;
+        long lo = strtol(list, &end, 10), hi = lo;
+        if (end == list)
+            break;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        n += hi - lo + 1;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return n > 0 ? n : 1;
+}
+
+
+static int from_sysfs(cache_topology* t) {
+    char buf[256];
+    int found = 0;
+    for (int i = 0; read_sysfs(i, "level", buf, sizeof(buf)); ++i) {
+        int level = atoi(buf);
+        if (!read_sysfs(i, "type", buf, sizeof(buf)) || strcmp(buf, "Instruction") == 0)
+            continue;
+
+        cache_level c;
+        memset(&c, 0, sizeof(c));
+        if (read_sysfs(i, "size", buf, sizeof(buf))) {
+            char* unit;
+            c.size = strtol(buf, &unit, 10);
+            if (*unit == 'K')
+                c.size <<= 10;
+            else if (*unit == 'M')
+                c.size <<= 20;
+        }
+        if (read_sysfs(i, "ways_of_associativity", buf, sizeof(buf)))
+            c.ways = atoi(buf);
+        if (read_sysfs(i, "coherency_line_size", buf, sizeof(buf)))
+            c.line = atoi(buf);
+        c.shared = read_sysfs(i, "shared_cpu_list", buf, sizeof(buf)) ? count_cpus(buf) : 1;
+
+        if (c.size > 0) {
+            record(t, level, &c);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+
+static int from_cpuid(cache_topology* t) {
+    int found = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    unsigned leaf = 4;
+    if (__get_cpuid_max(0x80000000, NULL) >= 0x8000001D && __get_cpuid_count(0x8000001D, 0, &eax, &ebx, &ecx, &edx) && (eax & 0x1F))
+        leaf = 0x8000001D;
+
+    for (unsigned i = 0; __get_cpuid_count(leaf, i, &eax, &ebx, &ecx, &edx); ++i) {
+        int type = eax & 0x1F;   // 0 none, 1 data, 2 instruction, 3 unified
+        if (type == 0)
+            break;
+        if (type == 2)
+            continue;
+
+        cache_level c;
+        c.ways = ((ebx >> 22) & 0x3FF) + 1;
+        c.line = (ebx & 0xFFF) + 1;
+        int partitions = ((ebx >> 12) & 0x3FF) + 1;
+        c.size = c.ways * partitions * c.line * (int) (ecx + 1);
+        c.shared = ((eax >> 14) & 0xFFF) + 1;
+        if (eax & (1 << 9))      // fully associative
+            c.ways = 0;
+        record(t, (eax >> 5) & 0x7, &c);
+        found = 1;
+    }
+#else
+    (void) t;
+#endif
+    return found;
+}
+
+
+static void detect(void) {
+    memset(&topology, 0, sizeof(topology));
+    if (!from_sysfs(&topology))
+        from_cpuid(&topology);
+}
+
+
+const cache_topology* host_caches(void) {
+    pthread_once(&topology_once, detect);
+    return &topology;
+}
+
+
+int cache_way_size(const cache_level* c) {
+    return c->ways > 0 ? c->size / c->ways : c->size;
+}
+
+
+// Lines of c that n accesses stride bytes apart share per set, taking the
+// stride to the nearest line below. 0 if c's geometry is unknown.
+int cache_set_load(const cache_level* c, long stride, int n) {
+    if (c->size == 0 || c->ways <= 0 || c->line <= 0)
+        return 0;
+    long sets = c->size / ((long) c->ways * c->line);
+    if (sets < 1)
+        return 0;
+    long a = (stride / c->line) % sets, g = sets;
+    while (a) {
+        long t = g % a;
+        g = a;
+        a = t;
+    }
+    long distinct = sets / g;
+    return (int) ((n + distinct - 1) / distinct);
+}
@@ -0,0 +1,31 @@
+#ifndef _CACHE_INFO_H
+#define _CACHE_INFO_H
+
+/*
+ * Data cache geometry of the host, read once from sysfs, or CPUID where
+ * sysfs isn't there. Levels that can't be found have size 0.
+ */
+
+typedef struct {
+    int size;      // bytes
+    int ways;      // associativity; 0 if fully associative / unknown
+    int line;      // line size in bytes
+    int shared;    // logical CPUs sharing this cache
+} cache_level;
+
+typedef struct {
+    cache_level l1d;
+    cache_level l2;
+    cache_level l3;
+} cache_topology;
+
+const cache_topology* host_caches(void);
+
+// Bytes in one way of c: the span of addresses that map to distinct sets
+int cache_way_size(const cache_level* c);
+
+// How many lines n accesses stride bytes apart pile into the busiest set
+// of c; more than its ways and they evict each other however small n is
+int cache_set_load(const cache_level* c, long stride, int n);
+
+#endif
@@ -8,37 +8,152 @@
 #include <stdio.h>  // For: perror
 #include <string.h> // For: memset
 #include <getopt.h>
+#include "cmdLine.h"
 
-void cmdLine(int argc, char *argv[], int* n, int *noCheck){
+void cmdLine(int argc, char *argv[], options* opt){
 /// Command line arguments
  // Default value of the matrix size
  static struct option long_options[] = {
         {"no-check", no_argument, 0, 'c'},
         {"n", required_argument, 0, 'n'},
+        {"threads", required_argument, 0, 't'},
+        {"rect", no_argument, 0, 'r'},
+        {"batch", required_argument, 0, 'b'},
+        {"prepacked", no_argument, 0, 'K'},
+        {"precision", required_argument, 0, 'p'},
+        {"strassen", required_argument, 0, 'w'},
+        {"placement", required_argument, 0, 'm'},
+        {"pages", required_argument, 0, 'H'},
+        {"perf", required_argument, 0, 'P'},
+        {"format", required_argument, 0, 'f'},
+        {"roofline", no_argument, 0, 'R'},
+        {"warmup", required_argument, 0, 'W'},
+        {"trials", required_argument, 0, 'T'},
+        {"sample-time", required_argument, 0, 'S'},
+        {"cold", no_argument, 0, 'C'},
+        {"affinity", required_argument, 0, 'a'},
+        {0, 0, 0, 0}
     };
 
  // Set default values
-    *n=0;
-    *noCheck = 0;
+    opt->n=0;
+    opt->noCheck = 0;
+    opt->nThreads = 0;
+    opt->rect = 0;
+    opt->batch = 0;
+    opt->prepacked = 0;
+    opt->prec = "d";
+    opt->strassen = 0;
+    opt->placement = NULL;
+    opt->pages = NULL;
+    opt->perf = NULL;
+    opt->format = NULL;
+    opt->roofline = 0;
+    // Five samples of 20 ms: the old single 0.1 s measurement's budget
+    opt->warmup = 1;
+    opt->trials = 5;
+    opt->minTime = 0.02;
+    opt->cold = 0;
+    opt->cpu = -1;
     // Process command line arguments
  int ac;
  for(ac=1;ac<argc;ac++) {
     int c;
-    while ((c=getopt_long(argc,argv,"cn:",long_options,NULL)) != -1){
+    while ((c=getopt_long(argc,argv,"cn:t:rb:Kp:w:m:H:P:f:RW:T:S:Ca:",long_options,NULL)) != -1){
         switch (c) {
 
 	    // Size of the matrix
             case 'n':
-                *n = atoi(optarg);
+                opt->n = atoi(optarg);
                 break;
 	    // Dont' check accuracy - used for tallying cache activity
             case 'c':
-                *noCheck = 1;
+                opt->noCheck = 1;
+                break;
+
+	    // Sweep the thread count from 1 up to this many (parallel builds only)
+            case 't':
+                opt->nThreads = atoi(optarg);
+                break;
+
+	    // Run the rectangular / transposed shape sweep through dgemm()
+            case 'r':
+                opt->rect = 1;
+                break;
+
+	    // Time dgemm_batch on this many independent problems of each size
+            case 'b':
+                opt->batch = atoi(optarg);
+                break;
+
+	    // Time dgemm_compute_packed against a B packed once by dgemm_pack_b
+            case 'K':
+                opt->prepacked = 1;
+                break;
+
+	    // Element type: d, s, ds (float in, double out) or z
+            case 'p':
+                opt->prec = optarg;
+                break;
+
+	    // Strassen-Winograd above this size (dgemm_set_strassen_cutoff)
+            case 'w':
+                opt->strassen = atoi(optarg);
+                break;
+
+	    // NUMA placement of the matrices: interleave, local or remote (numa=1 builds)
+            case 'm':
+                opt->placement = optarg;
+                break;
+
+	    // Pages for the matrices and packing buffers: small, thp or huge (dgemm_set_pages)
+            case 'H':
+                opt->pages = optarg;
+                break;
+
+	    // Record hardware counters per size, printed as csv or json
+            case 'P':
+                opt->perf = optarg;
+                break;
+
+	    // Machine-readable output: csv or json records with the run's metadata
+            case 'f':
+                opt->format = optarg;
+                break;
+
+	    // Measure peak FMA throughput and memory bandwidth, and report each size against them
+            case 'R':
+                opt->roofline = 1;
+                break;
+
+	    // Untimed calls before each size is timed
+            case 'W':
+                opt->warmup = atoi(optarg);
+                break;
+
+	    // Timed samples per size; the median is reported, with p5 / p95 / stddev
+            case 'T':
+                opt->trials = atoi(optarg);
+                break;
+
+	    // Minimum seconds per warm sample
+            case 'S':
+                opt->minTime = atof(optarg);
+                break;
+
+	    // Cold caches: flush the LLC before every sample, which is one call
+            case 'C':
+                opt->cold = 1;
+                break;
+
+	    // Pin the benchmark's thread to this cpu
+            case 'a':
+                opt->cpu = atoi(optarg);
                 break;
 
 	    // Error
             default:
-                printf("Usage: mmpy [-n <matrix dim>]\n");
+                printf("Usage: mmpy [-n <matrix dim>] [-c] [-t <max threads>] [-r] [-b <batch>] [-K] [-p d|s|ds|z] [-w <strassen cutoff>] [-m interleave|local|remote] [-H small|thp|huge] [-P csv|json] [-f csv|json] [-R] [-W <warmup>] [-T <trials>] [-S <sample seconds>] [-C] [-a <cpu>]\n");
                 exit(-1);
             }
     }
@@ -0,0 +1,28 @@
+#ifndef _CMDLINE_H
+#define _CMDLINE_H
+
+// Benchmark settings, from the command line
+typedef struct {
+    int n;                  // -n: one size only, 0 for the whole list
+    int noCheck;            // -c: skip the accuracy check
+    int nThreads;           // -t: sweep 1 .. nThreads threads
+    int rect;               // -r: rectangular / transposed sweep
+    int batch;              // -b: dgemm_batch of this many problems
+    int prepacked;          // -K: dgemm_compute_packed against a B packed once
+    const char* prec;       // -p: d, s, ds or z
+    int strassen;           // -w: Strassen-Winograd cutoff, 0 for off
+    const char* placement;  // -m: NUMA placement, or NULL
+    const char* pages;      // -H: page size of the matrices, or NULL
+    const char* perf;       // -P: counter records as csv / json, or NULL
+    const char* format;     // -f: records as csv / json, or NULL for text
+    int roofline;           // -R: measure the roofline and place each size under it
+    int warmup;             // -W: untimed calls first
+    int trials;             // -T: timed samples per size
+    double minTime;         // -S: seconds per warm sample at least
+    int cold;               // -C: flush the caches before every sample
+    int cpu;                // -a: pin the benchmark to this cpu, -1 for none
+} options;
+
+void cmdLine(int argc, char *argv[], options* opt);
+
+#endif
@@ -9,6 +9,7 @@
 #else
 #include "cblas.h"
 #endif
+#include "dgemm.h"
 
 const char* dgemm_desc = "Reference dgemm.";
 
@@ -42,3 +43,51 @@ void square_dgemm (int N, double* A, double* B, double* C)
                  Alpha, A, LDA, B, LDB, Beta, C, LDC );
 	    
 }
+
+
+/* General entry point, see dgemm.h; the enum values are the CBLAS ones */
+void dgemm (enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+            int M, int N, int K, double alpha, const double* A, int lda,
+            const double* B, int ldb, double beta, double* C, int ldc)
+{
+    cblas_dgemm( (enum CBLAS_ORDER) layout, (enum CBLAS_TRANSPOSE) transA, (enum CBLAS_TRANSPOSE) transB,
+                 M, N, K, alpha, A, lda, B, ldb, beta, C, ldc );
+}
+
+
+void dgemm_batch (enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                  int M, int N, int K, double alpha, const double* const* A, int lda,
+                  const double* const* B, int ldb, double beta, double* const* C, int ldc, int batch)
+{
+    for (int i = 0; i < batch; ++i)
+        dgemm( layout, transA, transB, M, N, K, alpha, A[i], lda, B[i], ldb, beta, C[i], ldc );
+}
+
+
+void dgemm_batch_strided (enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                          int M, int N, int K, double alpha, const double* A, int lda, long stride_a,
+                          const double* B, int ldb, long stride_b, double beta, double* C, int ldc, long stride_c,
+                          int batch)
+{
+    for (int i = 0; i < batch; ++i)
+        dgemm( layout, transA, transB, M, N, K, alpha, A + i * stride_a, lda, B + i * stride_b, ldb,
+               beta, C + i * stride_c, ldc );
+}
+
+
+void sgemm (enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+            int M, int N, int K, float alpha, const float* A, int lda,
+            const float* B, int ldb, float beta, float* C, int ldc)
+{
+    cblas_sgemm( (enum CBLAS_ORDER) layout, (enum CBLAS_TRANSPOSE) transA, (enum CBLAS_TRANSPOSE) transB,
+                 M, N, K, alpha, A, lda, B, ldb, beta, C, ldc );
+}
+
+
+void zgemm (enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+            int M, int N, int K, const void* alpha, const void* A, int lda,
+            const void* B, int ldb, const void* beta, void* C, int ldc)
+{
+    cblas_zgemm( (enum CBLAS_ORDER) layout, (enum CBLAS_TRANSPOSE) transA, (enum CBLAS_TRANSPOSE) transB,
+                 M, N, K, alpha, A, lda, B, ldb, beta, C, ldc );
+}
@@ -6,631 +6,2037 @@
  *    Support CBLAS interface
  */
 
-#include <immintrin.h>
-//#include <x86intrin.h>
-#include <avx2intrin.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache-info.h"
+#include "dgemm.h"
+#include "huge-pages.h"
+#include "kernel.h"
+#ifdef PARALLEL
+#include "threadpool.h"
+#ifdef NUMA
+#include <numa.h>
+#endif
+#else
+// Serial builds run on one node whatever numa=1 says
+#undef NUMA
+#endif
+
+
+// Built with -DSINGLE this file is sgemm instead: the same blocking and
+// packing on float, with the float kernels and their own tuning file, and
+// every public name below starting with s instead of d.
+#ifdef SINGLE
+typedef float real;
+#define micro_kernel smicro_kernel
+#define select_kernel select_skernel
+#define find_kernel find_skernel
+#define set_kernel set_skernel
+#define dgemm_kernels sgemm_kernels
+#define dgemm sgemm
+#define dgemm_batch sgemm_batch
+#define dgemm_batch_strided sgemm_batch_strided
+#define square_dgemm square_sgemm
+#define dgemm_get_blocking sgemm_get_blocking
+#define dgemm_set_blocking sgemm_set_blocking
+#define dgemm_load_tuning sgemm_load_tuning
+#define dgemm_save_tuning sgemm_save_tuning
+#define dgemm_kernel_name sgemm_kernel_name
+#define dgemm_kernel_at sgemm_kernel_at
+#define dgemm_set_kernel sgemm_set_kernel
+#define dgemm_packed sgemm_packed
+#define dgemm_pack_a sgemm_pack_a
+#define dgemm_pack_b sgemm_pack_b
+#define dgemm_compute_packed sgemm_compute_packed
+#define dgemm_compute_packed_a sgemm_compute_packed_a
+#define dgemm_packed_free sgemm_packed_free
+#define dgemm_packed_save sgemm_packed_save
+#define dgemm_packed_map sgemm_packed_map
+#define dgemm_set_num_threads sgemm_set_num_threads
+#define dgemm_set_strassen_cutoff sgemm_set_strassen_cutoff
+#define dgemm_desc sgemm_desc
+// Where the tuning file is read from unless this variable names another
+#define TUNING_ENV "SGEMM_TUNING"
+#define TUNING_FILE "sgemm-tuning.txt"
+#define STRASSEN_ENV "SGEMM_STRASSEN"
+#define PREFETCH_ENV "SGEMM_PREFETCH"
+#else
+typedef double real;
+#define TUNING_ENV "DGEMM_TUNING"
+#define TUNING_FILE "dgemm-tuning.txt"
+#define STRASSEN_ENV "DGEMM_STRASSEN"
+#define PREFETCH_ENV "DGEMM_PREFETCH"
+#endif
+
+#ifdef PARALLEL
+const char* dgemm_desc = "Parallel blocked dgemm.";
+#else
 const char* dgemm_desc = "Simple blocked dgemm.";
+#endif
 
 
-/**
-lv1 cache: 32k
-lv2 cache: 256k
-lv3 cache: 10k+k
-**/
+// The register tile (mr x nr) comes from the micro-kernel picked at
+// runtime, see kernel.h: DGEMM_KERNEL, or else the tuning file's kernel
+// line, or else the default tile of the widest ISA. Block sizes need not
+// be multiples of it: ragged tiles go to the kernel's edge function.
 
+// Default block sizes. Each problem goes to a size bucket by its largest
+// dimension. The medium and large buckets are re-derived from the host's
+// caches at startup (derive_blocking), and a tuning file written by
+// autotune can override any bucket for the kernel it was tuned with, see
+// load_tuning. The fixed values below are used where the caches can't be
+// read.
 
-//128 - 500
-#define REGA 3
-#define REGB 4 // B = 4*4
-//#define BLOCK_SIZE1 96
-
+// For small matrices (largest dimension < SMALL_LIMIT)
+#define SMALL_LIMIT 128
+#define BLOCK_SIZE2_SMALL 48
+#define L1_BLOCK_SIZE_M_SMALL 48
+#define L1_BLOCK_SIZE_N_SMALL 16
+#define L1_BLOCK_SIZE_K_SMALL 16
 
-// For large matrices
+// For medium (< MEDIUM_LIMIT) and large matrices
+#define MEDIUM_LIMIT 512
 #define BLOCK_SIZE2 192
 #define L1_BLOCK_SIZE_M 48
 #define L1_BLOCK_SIZE_N 32
 #define L1_BLOCK_SIZE_K 32
-#define REG_BLOCK_SIZE_M REGA
-#define REG_BLOCK_S48IZE_N REGB * 4
-#define REG_BLOCK_SIZE_K L1_BLOCK_SIZE_K
+// Rows of A packed per ic step against one B panel; small enough that the
+// A and C slabs stay in L2 while the B panel is streamed.
+#define PANEL_BLOCK_SIZE_M L1_BLOCK_SIZE_M
 
 
-// For small matrices
-#define BLOCK_SIZE2_SMALL 48
-#define L1_BLOCK_SIZE_M_SMALL 48
-#define L1_BLOCK_SIZE_N_SMALL 16
-#define L1_BLOCK_SIZE_K_SMALL 16
-#define REG_BLOCK_SIZE_M_SMALL REGA
-#define REG_BLOCK_SIZE_N_SMALL REGB * 4
-#define REG_BLOCK_SIZE_K_SMALL L1_BLOCK_SIZE_K_SMALL
+// Problems with every dimension up to this skip packing, see do_small_direct
+#define SMALL_DIRECT 64
+
+// Software prefetch distances, see dgemm_blocking: A and B in K steps, C in
+// register tiles. Off by default: on the hosts measured so far the
+// hardware prefetchers keep up with the packed slivers and C_padded, and
+// the extra instructions cost a few percent. autotune turns them on where
+// they pay.
+#define PREFETCH_A 0
+#define PREFETCH_B 0
+#define PREFETCH_C 0
+// Upper bound on a tuned distance
+#define MAX_PREFETCH 64
 
 
+// Upper bound on any tuned block size, to keep workspace sizes sane
+#define MAX_BLOCK 4096
+
+// Smallest Strassen cutoff; below it the extra additions cost more than
+// the multiplies they save
+#define STRASSEN_MIN 64
+
+
+// Packed buffers are aligned for full-width zmm loads
+#define ALIGNMENT 64
+
 #define min(a,b) (((a)<(b))?(a):(b))
+#define round_up(x, m) ((((x) + (m) - 1) / (m)) * (m))
+
+
+static const dgemm_blocking default_buckets[DGEMM_BUCKETS] = {
+    { SMALL_LIMIT, L1_BLOCK_SIZE_M_SMALL, BLOCK_SIZE2_SMALL, BLOCK_SIZE2_SMALL,
+      L1_BLOCK_SIZE_M_SMALL, L1_BLOCK_SIZE_N_SMALL, L1_BLOCK_SIZE_K_SMALL, PREFETCH_A, PREFETCH_B, PREFETCH_C },
+    { MEDIUM_LIMIT, PANEL_BLOCK_SIZE_M, BLOCK_SIZE2, BLOCK_SIZE2,
+      L1_BLOCK_SIZE_M, L1_BLOCK_SIZE_N, L1_BLOCK_SIZE_K, PREFETCH_A, PREFETCH_B, PREFETCH_C },
+    { 0, PANEL_BLOCK_SIZE_M, BLOCK_SIZE2, BLOCK_SIZE2,
+      L1_BLOCK_SIZE_M, L1_BLOCK_SIZE_N, L1_BLOCK_SIZE_K, PREFETCH_A, PREFETCH_B, PREFETCH_C },
+};
+
+// Filled in by load_tuning, and again for each dgemm_set_kernel
+static dgemm_blocking buckets[DGEMM_BUCKETS];
+
+static pthread_once_t tuning_once = PTHREAD_ONCE_INIT;
+
+// Set once dgemm_set_kernel picked the kernel, so dgemm_save_tuning
+// records it as the one to use
+static int kernel_chosen = 0;
+
+// square_dgemm recurses with Strassen-Winograd above this size; 0 is off
+static int strassen_cutoff = 0;
+
+#ifdef PARALLEL
+// DGEMM_PIPELINE=0 packs each B panel in a pool_run of its own again, see
+// do_matrix_parallel
+static int pipeline = 1;
+#endif
+
+
+static int valid_blocking(const dgemm_blocking* b) {
+    return b->mc > 0 && b->mc <= MAX_BLOCK
+        && b->kc > 0 && b->kc <= MAX_BLOCK
+        && b->nc > 0 && b->nc <= MAX_BLOCK
+        && b->l1_m > 0 && b->l1_m <= MAX_BLOCK
+        && b->l1_n > 0 && b->l1_n <= MAX_BLOCK
+        && b->l1_k > 0 && b->l1_k <= MAX_BLOCK
+        && b->pf_a >= 0 && b->pf_a <= MAX_PREFETCH
+        && b->pf_b >= 0 && b->pf_b <= MAX_PREFETCH
+        && b->pf_c >= 0 && b->pf_c <= MAX_PREFETCH;
+}
+
+
+static int set_bucket(int bucket, const dgemm_blocking* b) {
+    if (bucket < 0 || bucket >= DGEMM_BUCKETS || !valid_blocking(b))
+        return -1;
+    int max_dim = buckets[bucket].max_dim;
+    buckets[bucket] = *b;
+    buckets[bucket].max_dim = max_dim;
+    return 0;
+}
+
+
+static int set_cutoff(int cutoff) {
+    if (cutoff != 0 && cutoff < STRASSEN_MIN)
+        return -1;
+    strassen_cutoff = cutoff;
+    return 0;
+}
+
+
+static void load_tuning(void);
+
+
+// Both load the tuning file first, so it can't later override what the
+// caller read or set here.
+int dgemm_get_blocking(int bucket, dgemm_blocking* b) {
+    pthread_once(&tuning_once, load_tuning);
+    if (bucket < 0 || bucket >= DGEMM_BUCKETS)
+        return -1;
+    *b = buckets[bucket];
+    return 0;
+}
+
+
+int dgemm_set_blocking(int bucket, const dgemm_blocking* b) {
+    pthread_once(&tuning_once, load_tuning);
+    return set_bucket(bucket, b);
+}
+
+
+// After load_tuning, which may pick the kernel from the tuning file
+const char* dgemm_kernel_name(void) {
+    pthread_once(&tuning_once, load_tuning);
+    return select_kernel()->name;
+}
+
+
+const char* dgemm_kernel_at(int i) {
+    for (int j = 0; dgemm_kernels[j]; ++j)
+        if (find_kernel(dgemm_kernels[j]->name) && i-- == 0)
+            return dgemm_kernels[j]->name;
+    return NULL;
+}
+
+
+static void reset_buckets(const micro_kernel* kernel);
+static void prefetch_from_env(void);
+
+
+int dgemm_set_kernel(const char* name) {
+    pthread_once(&tuning_once, load_tuning);
+    const micro_kernel* kernel = find_kernel(name);
+    if (!kernel)
+        return -1;
+    set_kernel(kernel);
+    kernel_chosen = 1;
+    reset_buckets(kernel);
+    const char* path = getenv(TUNING_ENV);
+    dgemm_load_tuning(path ? path : TUNING_FILE);
+    prefetch_from_env();
+    return 0;
+}
 
 
+// One line per bucket:
+//   <kernel> <bucket> <mc> <kc> <nc> <l1_m> <l1_n> <l1_k> <pf_a> <pf_b> <pf_c>
+// Lines for other kernels than the selected one are skipped, so one file
+// can hold the results for several machines / DGEMM_KERNEL settings.
+// Lines without the prefetch distances keep the built-in ones. An
+// optional line
+//   kernel <name>
+// names the kernel to use when DGEMM_KERNEL isn't set, see load_tuning.
+int dgemm_load_tuning(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    // Not dgemm_kernel_name: this runs inside load_tuning too
+    const char* kernel = select_kernel()->name;
+    char line[256], name[64];
+    int bucket, loaded = 0;
+    dgemm_blocking b;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+        int fields = sscanf(line, "%63s %d %d %d %d %d %d %d %d %d %d", name, &bucket,
+                            &b.mc, &b.kc, &b.nc, &b.l1_m, &b.l1_n, &b.l1_k, &b.pf_a, &b.pf_b, &b.pf_c);
+        if (fields != 8 && fields != 11)
+            continue;
+        if (fields == 8 && bucket >= 0 && bucket < DGEMM_BUCKETS) {
+            b.pf_a = default_buckets[bucket].pf_a;
+            b.pf_b = default_buckets[bucket].pf_b;
+            b.pf_c = default_buckets[bucket].pf_c;
+        }
+        if (strcmp(name, kernel) == 0 && set_bucket(bucket, &b) == 0)
+            ++loaded;
+    }
+    fclose(f);
+    return loaded;
+}
+
+
+// Rewrites path with the current buckets for the selected kernel, keeping
+// the lines of any other kernel already in it. The kernel line is kept
+// too, unless dgemm_set_kernel chose one, which replaces it.
+int dgemm_save_tuning(const char* path) {
+    const char* kernel = dgemm_kernel_name();
+    char others[64][256], chosen[256] = "";
+    int nothers = 0;
+    char line[256], name[64];
+
+    FILE* f = fopen(path, "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f) && nothers < 64) {
+            if (line[0] == '#' || sscanf(line, "%63s", name) != 1 || strcmp(name, kernel) == 0)
+                continue;
+            if (strcmp(name, "kernel") == 0)
+                strcpy(chosen, line);
+            else
+                strcpy(others[nothers++], line);
+        }
+        fclose(f);
+    }
+    if (kernel_chosen)
+        snprintf(chosen, sizeof(chosen), "kernel %s\n", kernel);
+
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+    fprintf(f, "# Block sizes, written by autotune\n");
+    fprintf(f, "# kernel bucket mc kc nc l1_m l1_n l1_k pf_a pf_b pf_c\n");
+    fputs(chosen, f);
+    for (int i = 0; i < nothers; ++i)
+        fputs(others[i], f);
+    for (int i = 0; i < DGEMM_BUCKETS; ++i)
+        fprintf(f, "%s %d %d %d %d %d %d %d %d %d %d\n", kernel, i, buckets[i].mc, buckets[i].kc,
+                buckets[i].nc, buckets[i].l1_m, buckets[i].l1_n, buckets[i].l1_k,
+                buckets[i].pf_a, buckets[i].pf_b, buckets[i].pf_c);
+    return fclose(f) == 0 ? 0 : -1;
+}
 
 
-// M = REGA = 3, N = REGB*256/64 = 16
-// for block1, M = 3, N = 16, which means all c00-c13 are stored in C
-// K changeable
-static inline void avx_kernel(int K, double* restrict A, double* restrict B, double* restrict C) {
-    register __m256d c00, c01, c02, c03;
-    register __m256d c10, c11, c12, c13;
-    register __m256d c20, c21, c22, c23;
-    //totally 3*4*4 = 48 8float/per refresh
-    //__m256d zero = _mm256_set1_pd(0.0);
-    c00 = _mm256_loadu_pd(&C[0 * BLOCK_SIZE2 + 0]);
-    c01 = _mm256_loadu_pd(&C[0 * BLOCK_SIZE2 + 4]);
-    c02 = _mm256_loadu_pd(&C[0 * BLOCK_SIZE2 + 8]);
-    c03 = _mm256_loadu_pd(&C[0 * BLOCK_SIZE2 + 12]);
-    c10 = _mm256_loadu_pd(&C[1 * BLOCK_SIZE2 + 0]);
-    c11 = _mm256_loadu_pd(&C[1 * BLOCK_SIZE2 + 4]);
-    c12 = _mm256_loadu_pd(&C[1 * BLOCK_SIZE2 + 8]);
-    c13 = _mm256_loadu_pd(&C[1 * BLOCK_SIZE2 + 12]);
-    c20 = _mm256_loadu_pd(&C[2 * BLOCK_SIZE2 + 0]);
-    c21 = _mm256_loadu_pd(&C[2 * BLOCK_SIZE2 + 4]);
-    c22 = _mm256_loadu_pd(&C[2 * BLOCK_SIZE2 + 8]);
-    c23 = _mm256_loadu_pd(&C[2 * BLOCK_SIZE2 + 12]);
+// Analytic block sizes for kernel k on this host, in the spirit of Low et
+// al., "Analytical modeling is enough for high-performance BLIS". Budgets
+// are counted in cache ways rather than bytes: a packed buffer that fits
+// in w ways of a set-associative cache can't evict itself through set
+// conflicts however its address falls, which a bytes-only budget doesn't
+// guarantee.
+//  - kc: the A (mr x kc) and B (kc x nr) slivers the kernel streams share
+//    L1 with one way left for C.
+//  - nc: the packed B panel (kc x nc) gets half of L2, so it is reused
+//    from L2 by every row slab; it is also kept within this core's share
+//    of L3 minus a way.
+//  - mc: the A slab (mc x kc) and the C slab it updates (mc x nc) get the
+//    other half of L2, less a way for the B slivers passing through. That
+//    slab is C itself when plan_packing updates it in place, or its copy
+//    in C_padded when ldc would crowd the cache sets; the budget is the
+//    same either way.
+// Returns nonzero if L1 or L2 is unknown and b was left alone.
+static int derive_blocking(const micro_kernel* k, const cache_topology* caches, dgemm_blocking* b) {
+    const cache_level* l1 = &caches->l1d;
+    const cache_level* l2 = &caches->l2;
+    const cache_level* l3 = &caches->l3;
+    if (l1->size == 0 || l2->size == 0)
+        return 1;
+
+    int w1 = l1->ways > 1 ? l1->ways : 2;
+    int w2 = l2->ways > 1 ? l2->ways : 2;
+    long way1 = cache_way_size(l1);
+    long way2 = cache_way_size(l2);
+    int d = sizeof(real);
+
+    long kc = (w1 - 1) * way1 / ((k->mr + k->nr) * d);
+    kc = kc < 16 ? 16 : kc / 8 * 8;
+
+    long nc = (w2 / 2) * way2 / (kc * d);
+    if (l3->size > 0 && l3->ways > 1) {
+        long l3_nc = (l3->ways - 1) * (long) cache_way_size(l3) / (l3->shared > 0 ? l3->shared : 1) / (kc * d);
+        if (l3_nc < nc)
+            nc = l3_nc;
+    }
+    nc = nc < k->nr ? k->nr : nc / k->nr * k->nr;
+
+    long mc = (w2 - w2 / 2 - 1) * way2 / ((kc + nc) * d);
+    mc = mc < k->mr ? k->mr : mc / k->mr * k->mr;
+
+    b->kc = min (kc, MAX_BLOCK);
+    b->nc = min (nc, MAX_BLOCK / k->nr * k->nr);
+    b->mc = min (mc, MAX_BLOCK / k->mr * k->mr);
+    // The whole slab in one L1 block; the kernel walks one B sliver at a
+    // time down all of A's slivers, so the sliver stays in L1
+    b->l1_m = b->mc;
+    b->l1_n = k->nr;
+    b->l1_k = b->kc;
+    return 0;
+}
+
 
-    for(int p = 0; p < K; ++p){
-        register __m256d a1 = _mm256_broadcast_sd(&A[0*BLOCK_SIZE2+p]);
-        register __m256d a2 = _mm256_broadcast_sd(&A[1*BLOCK_SIZE2+p]);
-        register __m256d a3 = _mm256_broadcast_sd(&A[2*BLOCK_SIZE2+p]);
+// The built-in buckets, with the medium and large ones derived for kernel
+static void reset_buckets(const micro_kernel* kernel) {
+    const cache_topology* caches = host_caches();
+    for (int i = 0; i < DGEMM_BUCKETS; ++i) {
+        buckets[i] = default_buckets[i];
+        if (i > 0)
+            derive_blocking(kernel, caches, &buckets[i]);
+    }
+}
 
-        register __m256d b = _mm256_loadu_pd(&B[p*BLOCK_SIZE2 + 0*8]);
-        c00 = _mm256_fmadd_pd(a1,b,c00);
-        c10 = _mm256_fmadd_pd(a2,b,c10);
-        c20 = _mm256_fmadd_pd(a3,b,c20);
 
-        b = _mm256_loadu_pd(&B[p*BLOCK_SIZE2 + 4 + 0*8]);
-        c01 = _mm256_fmadd_pd(a1,b,c01);
-        c11 = _mm256_fmadd_pd(a2,b,c11);
-        c21 = _mm256_fmadd_pd(a3,b,c21);
+// The kernel the tuning file's kernel line names, if it runs here
+static const micro_kernel* tuned_kernel(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return NULL;
+    const micro_kernel* kernel = NULL;
+    char line[256], name[64];
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "kernel %63s", name) == 1)
+            kernel = find_kernel(name);
+    fclose(f);
+    return kernel;
+}
 
-        b = _mm256_loadu_pd(&B[p*BLOCK_SIZE2 + 0 + 1*8]);
-        c02 = _mm256_fmadd_pd(a1,b,c02);
-        c12 = _mm256_fmadd_pd(a2,b,c12);
-        c22 = _mm256_fmadd_pd(a3,b,c22);
 
-        b = _mm256_loadu_pd(&B[p*BLOCK_SIZE2 + 4 + 1*8]);
-        c03 = _mm256_fmadd_pd(a1,b,c03);
-        c13 = _mm256_fmadd_pd(a2,b,c13);
-        c23 = _mm256_fmadd_pd(a3,b,c23);
+// DGEMM_PREFETCH=<pf_a>,<pf_b>,<pf_c> for every bucket, e.g. 0,0,0 to
+// measure without the software prefetches
+static void prefetch_from_env(void) {
+    const char* env = getenv(PREFETCH_ENV);
+    int a, b, c;
+    if (!env || sscanf(env, "%d,%d,%d", &a, &b, &c) != 3)
+        return;
+    for (int i = 0; i < DGEMM_BUCKETS; ++i) {
+        dgemm_blocking t = buckets[i];
+        t.pf_a = a;
+        t.pf_b = b;
+        t.pf_c = c;
+        set_bucket(i, &t);
     }
+}
+
+
+static void load_tuning(void) {
+    const char* path = getenv(TUNING_ENV);
+    if (!path)
+        path = TUNING_FILE;
+    const micro_kernel* kernel = getenv("DGEMM_KERNEL") ? NULL : tuned_kernel(path);
+    if (kernel)
+        set_kernel(kernel);
+
+    reset_buckets(select_kernel());
+    dgemm_load_tuning(path);
+    prefetch_from_env();
+
+    const char* cutoff = getenv(STRASSEN_ENV);
+    if (cutoff)
+        set_cutoff(atoi(cutoff));
+#ifdef PARALLEL
+    const char* env = getenv("DGEMM_PIPELINE");
+    if (env)
+        pipeline = atoi(env) != 0;
+#endif
+}
+
+
+// Block sizes for one call, with the L1 sizes rounded up to whole
+// register tiles of the selected kernel.
+typedef struct {
+    const micro_kernel* kernel;
+    int bucket;
+    int mc;
+    int kc;
+    int nc;
+    int l1_m;
+    int l1_n;
+    int l1_k;
+    int ld_c;       // leading dimension of C_padded, see skew_ld
+    int contig_a;   // pack A / B along their unit stride, see plan_packing
+    int contig_b;
+    int direct_c;   // the kernels update C in place, without C_padded; see plan_packing
+    int pf_a;       // prefetch distances of the bucket, see dgemm_blocking
+    int pf_b;
+    int pf_c;
+} blocking;
+
+
+// Leading dimension for an internal buffer with n columns: whole cache
+// lines, and an odd number of them, so consecutive rows never start in
+// the same set however n was tuned (nc = 512 would put every row of
+// C_padded in one L1 set).
+static inline int skew_ld(int n) {
+    int line = ALIGNMENT / sizeof(real);
+    int ld = round_up(n, line);
+    if ((ld / line) % 2 == 0)
+        ld += line;
+    return ld;
+}
 
 
-    _mm256_storeu_pd(&C[0], c00);
-    _mm256_storeu_pd(&C[4], c01);
+// The bucket whose block sizes an M x N x K problem uses
+static inline int find_bucket(int M, int N, int K) {
+    int dim = M > N ? (M > K ? M : K) : (N > K ? N : K);
+    int bucket = 0;
+    while (bucket < DGEMM_BUCKETS - 1 && dim >= buckets[bucket].max_dim)
+        ++bucket;
+    return bucket;
+}
 
-    _mm256_storeu_pd(&C[8], c02);
-    _mm256_storeu_pd(&C[12], c03);
 
-    _mm256_storeu_pd(&C[BLOCK_SIZE2], c10);
-    _mm256_storeu_pd(&C[BLOCK_SIZE2 + 4], c11);
+static inline void init_blocking(blocking* blk, const micro_kernel* kernel, int bucket, const dgemm_blocking* b) {
+    blk->kernel = kernel;
+    blk->bucket = bucket;
+    blk->mc = b->mc;
+    blk->kc = b->kc;
+    blk->nc = b->nc;
+    blk->l1_m = round_up(b->l1_m, kernel->mr);
+    blk->l1_n = round_up(b->l1_n, kernel->nr);
+    blk->l1_k = b->l1_k;
+    blk->ld_c = skew_ld(b->nc);
+    blk->contig_a = 0;
+    blk->contig_b = 0;
+    blk->direct_c = 0;
+    blk->pf_a = b->pf_a;
+    blk->pf_b = b->pf_b;
+    blk->pf_c = b->pf_c;
+}
 
-    _mm256_storeu_pd(&C[BLOCK_SIZE2 + 8], c12);
-    _mm256_storeu_pd(&C[BLOCK_SIZE2 + 12], c13);
 
-    _mm256_storeu_pd(&C[2 * BLOCK_SIZE2], c20);
-    _mm256_storeu_pd(&C[2 * BLOCK_SIZE2 + 4], c21);
+static inline void make_blocking(blocking* blk, int M, int N, int K) {
+    pthread_once(&tuning_once, load_tuning);
 
-    _mm256_storeu_pd(&C[2 * BLOCK_SIZE2 + 8], c22);
-    _mm256_storeu_pd(&C[2 * BLOCK_SIZE2 + 12], c23);
+    int bucket = find_bucket(M, N, K);
+    init_blocking(blk, select_kernel(), bucket, &buckets[bucket]);
 }
 
 
+// Per-thread packing buffers. They are allocated on a thread's first call,
+// grown when a larger blocking needs more, and kept across calls, so
+// repeated small multiplies don't pay for stack arrays and their zeroing
+// every time. The key's destructor frees them when the thread exits.
+typedef struct {
+    real* A_packed;
+    real* B_packed;
+    real* C_padded;
+    real* scratch;      // Strassen-Winograd temporaries, see strassen
+    real* B_next;       // second B panel of the pipelined parallel loop
+    size_t A_size, B_size, C_size, scratch_size, B_next_size;
+#ifdef NUMA
+    real* B_node[2][POOL_MAX_NODES];   // B panel copies, see node_panels
+    size_t B_node_size[2][POOL_MAX_NODES];
+#endif
+} workspace;
+
+
+static pthread_key_t workspace_key;
+static pthread_once_t workspace_once = PTHREAD_ONCE_INIT;
+
+
+static void workspace_free(void* p) {
+    workspace* ws = (workspace*) p;
+    page_free(ws->A_packed);
+    page_free(ws->B_packed);
+    page_free(ws->C_padded);
+    page_free(ws->scratch);
+    page_free(ws->B_next);
+#ifdef NUMA
+    for (int b = 0; b < 2; ++b)
+        for (int n = 0; n < POOL_MAX_NODES; ++n)
+            if (ws->B_node[b][n])
+                numa_free(ws->B_node[b][n], sizeof(real) * ws->B_node_size[b][n]);
+#endif
+    free(ws);
+}
 
-static inline void do_block_1(int M, int N, int K, double* restrict A_padded, double* restrict B_padded, double* restrict C_padded) {
-    for (int i = 0; i < M; i += REG_BLOCK_SIZE_M)
-        for (int j = 0; j < N; j += REG_BLOCK_SIZE_N)
-            for (int k = 0; k < K; k += REG_BLOCK_SIZE_K) {
-                int curK = min (REG_BLOCK_SIZE_K, K - k);
 
-                avx_kernel(curK,
-                           A_padded + i * BLOCK_SIZE2 + k,
-                           B_padded + k * BLOCK_SIZE2 + j,
-                           C_padded + i * BLOCK_SIZE2 + j);
-            }
+static void workspace_key_init(void) {
+    pthread_key_create(&workspace_key, workspace_free);
+}
+
+
+static void* checked_alloc(size_t bytes) {
+    void* p = NULL;
+    if (posix_memalign(&p, ALIGNMENT, bytes) != 0) {
+        fprintf(stderr, "dgemm: failed to allocate %zu byte workspace\n", bytes);
+        abort();
+    }
+    return p;
+}
+
+
+// Makes *buf hold at least n elements, on the pages dgemm_set_pages
+// asked for. Contents are not kept when it grows.
+static inline real* reserve(real** buf, size_t* size, size_t n) {
+    if (*size < n) {
+        page_free(*buf);
+        *buf = (real*) page_alloc(sizeof(real) * n);
+        if (!*buf) {
+            fprintf(stderr, "dgemm: failed to allocate %zu byte workspace\n", sizeof(real) * n);
+            abort();
+        }
+        *size = n;
+    }
+    return *buf;
 }
 
 
-static inline void do_block_2(int M, int N, int K, double* restrict A_padded, double* restrict B_padded, double* restrict C_padded) {
-//    if (M == 0 || N == 0 || K == 0)
-//        return;
+static workspace* thread_workspace(void) {
+    pthread_once(&workspace_once, workspace_key_init);
+    workspace* ws = (workspace*) pthread_getspecific(workspace_key);
+    if (!ws) {
+        ws = (workspace*) checked_alloc(sizeof(workspace));
+        memset(ws, 0, sizeof(workspace));
+        pthread_setspecific(workspace_key, ws);
+    }
+    return ws;
+}
+
 
-    for (int i = 0; i < M; i += L1_BLOCK_SIZE_M) {
-        int curM = min (L1_BLOCK_SIZE_M, M - i);
+// The calling thread's workspace, sized for blk: A and C hold one
+// mc row slab, B one whole kc x nc panel.
+static workspace* get_workspace(const blocking* blk) {
+    workspace* ws = thread_workspace();
+    reserve(&ws->A_packed, &ws->A_size, (size_t) round_up(blk->mc, blk->kernel->mr) * blk->kc);
+    reserve(&ws->B_packed, &ws->B_size, (size_t) blk->kc * round_up(blk->nc, blk->kernel->nr));
+    if (!blk->direct_c)
+        reserve(&ws->C_padded, &ws->C_size, (size_t) blk->mc * blk->ld_c);
+    return ws;
+}
 
-        for (int j = 0; j < N; j += L1_BLOCK_SIZE_N) {
-            int curN = min (L1_BLOCK_SIZE_N, N - j);
 
-            for (int k = 0; k < K; k += L1_BLOCK_SIZE_K) {
-                int curK = min (L1_BLOCK_SIZE_K, K - k);
+// Prefetches the lines of the m x n tile at C for writing
+static inline void prefetch_C(int m, int n, const real* C, int ldc) {
+    for (int r = 0; r < m; ++r) {
+        for (int c = 0; c < n; c += ALIGNMENT / sizeof(real))
+            __builtin_prefetch(&C[r * ldc + c], 1, 3);
+        __builtin_prefetch(&C[r * ldc + n - 1], 1, 3);
+    }
+}
 
-                do_block_1(curM, curN, curK,
-                           A_padded + i * BLOCK_SIZE2 + k,
-                           B_padded + k * BLOCK_SIZE2 + j,
-                           C_padded + i * BLOCK_SIZE2 + j);
+
+// A_packed / B_packed point into panels whose slivers are panel_K long:
+// sliver s of A starts at s * mr * panel_K, sliver t of B at t * nr * panel_K.
+// Ragged tiles on the right / bottom go to the kernel's edge function, so
+// only the valid part of C is computed. With pf_c, the tile pf_c tiles on
+// (in row order) is prefetched before each kernel call.
+static inline void do_block_1(const blocking* blk, int M, int N, int K, int panel_K,
+                              real* restrict A_packed, real* restrict B_packed, real* restrict C, int ldc) {
+    const micro_kernel* kernel = blk->kernel;
+    int tiles_n = (N + kernel->nr - 1) / kernel->nr;
+    int pf_a = blk->pf_a * kernel->mr;
+    int pf_b = blk->pf_b * kernel->nr;
+
+    for (int i = 0; i < M; i += kernel->mr) {
+        int m = min (kernel->mr, M - i);
+
+        for (int j = 0; j < N; j += kernel->nr) {
+            int n = min (kernel->nr, N - j);
+
+            if (blk->pf_c) {
+                int t = (i / kernel->mr) * tiles_n + j / kernel->nr + blk->pf_c;
+                int pi = t / tiles_n * kernel->mr, pj = t % tiles_n * kernel->nr;
+                if (pi < M)
+                    prefetch_C(min (kernel->mr, M - pi), min (kernel->nr, N - pj), C + pi * ldc + pj, ldc);
             }
+
+            if (m == kernel->mr && n == kernel->nr)
+                kernel->fn(K,
+                           A_packed + i * panel_K,
+                           B_packed + j * panel_K,
+                           C + i * ldc + j, ldc, pf_a, pf_b);
+            else
+                kernel->edge(m, n, K,
+                             A_packed + i * panel_K,
+                             B_packed + j * panel_K,
+                             C + i * ldc + j, ldc);
         }
     }
 }
 
 
-static inline void do_matrix(int lda, double* restrict A, double* restrict B, double* restrict C) {
-    double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) C_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
-    double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) A_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
-    double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) B_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
+static inline void do_block_2(const blocking* blk, int M, int N, int K,
+                              real* restrict A_packed, real* restrict B_packed, real* restrict C, int ldc) {
+    int mr = blk->kernel->mr;
+    int nr = blk->kernel->nr;
+
+    for (int i = 0; i < M; i += blk->l1_m) {
+        int curM = min (blk->l1_m, M - i);
 
-//    block_square_multilv2(lda, lda, lda, lda, A, B, C, A_padded, B_padded, C_padded);
-    // TODO: Array indexing vs. pointer arithmetic.
-    // pointer arithmetic: 6, 7, 6, 8, ....
-    // array indexing: 1, 2, 3, 4, ..., 17, 18, 18, 18, ...
+        for (int j = 0; j < N; j += blk->l1_n) {
+            int curN = min (blk->l1_n, N - j);
 
-    for (int i = 0; i < lda; i += BLOCK_SIZE2) {
-        int curM = min (BLOCK_SIZE2, lda - i);
+            for (int k = 0; k < K; k += blk->l1_k) {
+                int curK = min (blk->l1_k, K - k);
 
-        for (int j = 0; j < lda; j += BLOCK_SIZE2) {
-            int curN = min (BLOCK_SIZE2, lda - j);
+                do_block_1(blk, curM, curN, curK, K,
+                           A_packed + i * K + k * mr,
+                           B_packed + j * K + k * nr,
+                           C + i * ldc + j, ldc);
+            }
+        }
+    }
+}
 
-//            double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) C_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
 
-//            if (curN != BLOCK_SIZE2) {
-//                memset(C_padded, 0, sizeof(double) * BLOCK_SIZE2 * BLOCK_SIZE2);
-//            }
+// Copies a rows x cols block between row-major buffers with leading
+// dimensions ld_dst and ld_src, eight rows per iteration.
+static inline void copy_block(int rows, int cols, real* restrict dst, int ld_dst, real* restrict src, int ld_src) {
+    size_t bytes = sizeof(real) * cols;
+    int ii = 0;
+    int block_limit = (rows / 8) * 8;
+    while (ii < block_limit) {
+        memcpy(dst + ii * ld_dst, src + ii * ld_src, bytes);
+        memcpy(dst + (ii + 1) * ld_dst, src + (ii + 1) * ld_src, bytes);
+        memcpy(dst + (ii + 2) * ld_dst, src + (ii + 2) * ld_src, bytes);
+        memcpy(dst + (ii + 3) * ld_dst, src + (ii + 3) * ld_src, bytes);
+        memcpy(dst + (ii + 4) * ld_dst, src + (ii + 4) * ld_src, bytes);
+        memcpy(dst + (ii + 5) * ld_dst, src + (ii + 5) * ld_src, bytes);
+        memcpy(dst + (ii + 6) * ld_dst, src + (ii + 6) * ld_src, bytes);
+        memcpy(dst + (ii + 7) * ld_dst, src + (ii + 7) * ld_src, bytes);
+        ii += 8;
+    }
+    switch (rows - ii) {
+        case 7 : memcpy(dst + ii * ld_dst, src + ii * ld_src, bytes); ii++;
+        case 6 : memcpy(dst + ii * ld_dst, src + ii * ld_src, bytes); ii++;
+        case 5 : memcpy(dst + ii * ld_dst, src + ii * ld_src, bytes); ii++;
+        case 4 : memcpy(dst + ii * ld_dst, src + ii * ld_src, bytes); ii++;
+        case 3 : memcpy(dst + ii * ld_dst, src + ii * ld_src, bytes); ii++;
+        case 2 : memcpy(dst + ii * ld_dst, src + ii * ld_src, bytes); ii++;
+        case 1 : memcpy(dst + ii * ld_dst, src + ii * ld_src, bytes);
+    }
+}
 
-            int i_lda = i * lda;
-            int i_lda_plus_j = i_lda + j;
 
-//            for (int ii = 0; ii < curM; ++ii)
-//                for (int jj = 0; jj < curN; ++jj)
-//                    C_padded[ii][jj] = C[i_lda_plus_j + ii * lda + jj];
+// Element (i, p) of the M x K block is A[i * rs + p * cs]; transposes are
+// just swapped strides. The block is packed into mr-row slivers, each stored
+// k-major (all mr rows of column p, then column p + 1, ...) and scaled by
+// alpha. A short last sliver is zero-filled.
+static inline void pack_A_mr(int M, int K, int mr, const real* restrict A, int rs, int cs, real alpha, real* restrict A_packed) {
+    for (int i = 0; i < M; i += mr) {
+        int rows = min (mr, M - i);
+        const real* a = A + i * rs;
+        for (int p = 0; p < K; ++p) {
+            for (int r = 0; r < rows; ++r)
+                A_packed[r] = alpha * a[r * rs + p * cs];
+            for (int r = rows; r < mr; ++r)
+                A_packed[r] = 0.0;
+            A_packed += mr;
+        }
+    }
+}
 
-//            for (int ii = 0; ii < curM; ++ii)
-//                memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN);
 
-            // ---------------
-            int ii = 0;
-            int block_limit = (curM / 8) * 8;
-            while (ii < block_limit) {
-                memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 1], C + i_lda_plus_j + (ii + 1) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 2], C + i_lda_plus_j + (ii + 2) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 3], C + i_lda_plus_j + (ii + 3) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 4], C + i_lda_plus_j + (ii + 4) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 5], C + i_lda_plus_j + (ii + 5) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 6], C + i_lda_plus_j + (ii + 6) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 7], C + i_lda_plus_j + (ii + 7) * lda, sizeof(double) * curN);
-                ii += 8;
+// Element (p, j) of the K x N block is B[p * rs + j * cs]. The block is
+// packed into nr-column slivers, each stored row by row. A short last
+// sliver is zero-filled. With pf, rows of a row-major B are prefetched pf
+// rows ahead: they are a leading dimension apart, a stride the hardware
+// prefetchers pick up late if at all.
+static inline void pack_B_nr(int K, int N, int nr, const real* restrict B, int rs, int cs, int pf, real* restrict B_packed) {
+    for (int j = 0; j < N; j += nr) {
+        int cols = min (nr, N - j);
+        const real* b = B + j * cs;
+        for (int p = 0; p < K; ++p) {
+            if (pf && cs == 1 && p + pf < K)
+                for (int c = 0; c < cols; c += ALIGNMENT / sizeof(real))
+                    __builtin_prefetch(&b[(p + pf) * rs + c], 0, 3);
+            // Rows are short, so plain loops (unrolled for a constant nr)
+            // beat a memcpy / memset call per row
+            if (cs == 1 && cols == nr) {
+                for (int c = 0; c < nr; ++c)
+                    B_packed[c] = b[p * rs + c];
+            } else {
+                for (int c = 0; c < cols; ++c)
+                    B_packed[c] = b[p * rs + c * cs];
+                for (int c = cols; c < nr; ++c)
+                    B_packed[c] = 0.0;
             }
-            if (ii < curM) {
-                switch (curM - ii) {
-                    case 7 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 6 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 5 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 4 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 3 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 2 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 1 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN);
-                }
+            B_packed += nr;
+        }
+    }
+}
+
+
+// Same packed layout as pack_A_mr, but A is read along its unit stride,
+// so each source line is loaded once. Used when pack_A_mr's walk (mr rows
+// a leading dimension apart per column, or one column per lda step)
+// would keep landing in the same cache sets, see plan_packing.
+static inline void pack_A_contig(int M, int K, int mr, const real* restrict A, int rs, int cs, real alpha, real* restrict A_packed) {
+    for (int i = 0; i < M; i += mr) {
+        int rows = min (mr, M - i);
+        real* dst = A_packed + i * K;
+        for (int r = rows; r < mr; ++r)
+            for (int p = 0; p < K; ++p)
+                dst[p * mr + r] = 0.0;
+    }
+    if (cs == 1) {
+        for (int i = 0; i < M; ++i) {
+            const real* a = A + i * rs;
+            real* dst = A_packed + (i / mr) * mr * K + i % mr;
+            for (int p = 0; p < K; ++p)
+                dst[p * mr] = alpha * a[p];
+        }
+    } else {
+        for (int p = 0; p < K; ++p) {
+            const real* a = A + p * cs;
+            for (int i = 0; i < M; i += mr) {
+                int rows = min (mr, M - i);
+                real* dst = A_packed + i * K + p * mr;
+                for (int r = 0; r < rows; ++r)
+                    dst[r] = alpha * a[(i + r) * rs];
             }
-            // ---------------
-
-            for (int k = 0; k < lda; k += BLOCK_SIZE2) {
-                int i_lda_plus_k = i_lda + k;
-                int k_lda_plus_j = k * lda + j;
-
-                int curK = min (BLOCK_SIZE2, lda - k);
-
-//                double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) A_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
-//                double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) B_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
-//                memset(A_padded, 0, sizeof(double) * BLOCK_SIZE2 * BLOCK_SIZE2);
-//                memset(B_padded, 0, sizeof(double) * BLOCK_SIZE2 * BLOCK_SIZE2);
-
-//                for (int ii = 0; ii < curM; ++ii)
-//                    for (int kk = 0; kk < curK; ++kk)
-//                        A_padded[ii][kk] = A[i_lda_plus_k + ii * lda + kk];
-
-//                for (int ii = 0; ii < curM; ++ii) {
-//                    memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK);
-//                }
-
-                // ---------------
-                int ii = 0;
-                int block_limit = (curM / 8) * 8;
-                while (ii < block_limit) {
-                    memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 1], A + i_lda_plus_k + (ii + 1) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 2], A + i_lda_plus_k + (ii + 2) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 3], A + i_lda_plus_k + (ii + 3) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 4], A + i_lda_plus_k + (ii + 4) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 5], A + i_lda_plus_k + (ii + 5) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 6], A + i_lda_plus_k + (ii + 6) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 7], A + i_lda_plus_k + (ii + 7) * lda, sizeof(double) * curK);
-                    ii += 8;
-                }
-                if (ii < curM) {
-                    switch (curM - ii) {
-                        case 7 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 6 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 5 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 4 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 3 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 2 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 1 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK);
-                    }
-                }
-                // ---------------
-
-//                for (int kk = 0; kk < curK; ++kk)
-//                    for (int jj = 0; jj < curN; ++jj)
-//                        B_padded[kk][jj] = B[k_lda_plus_j + kk * lda + jj];
-
-//                for (int kk = 0; kk < curK; ++kk)
-//                    memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN);
-
-                // ---------------
-                int kk = 0;
-                block_limit = (curK / 8) * 8;
-                while (kk < block_limit) {
-                    memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 1], B + k_lda_plus_j + (kk + 1) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 2], B + k_lda_plus_j + (kk + 2) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 3], B + k_lda_plus_j + (kk + 3) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 4], B + k_lda_plus_j + (kk + 4) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 5], B + k_lda_plus_j + (kk + 5) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 6], B + k_lda_plus_j + (kk + 6) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 7], B + k_lda_plus_j + (kk + 7) * lda, sizeof(double) * curN);
-                    kk += 8;
-                }
-                if (kk < curK) {
-                    switch (curK - kk) {
-                        case 7 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 6 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 5 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 4 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 3 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 2 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 1 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                    }
-                }
-                // ---------------
+        }
+    }
+}
+
+
+// The pack_B_nr layout, reading B along its unit stride like pack_A_contig
+static inline void pack_B_contig(int K, int N, int nr, const real* restrict B, int rs, int cs, real* restrict B_packed) {
+    for (int j = 0; j < N; j += nr) {
+        int cols = min (nr, N - j);
+        real* dst = B_packed + j * K;
+        for (int p = 0; p < K; ++p)
+            for (int c = cols; c < nr; ++c)
+                dst[p * nr + c] = 0.0;
+    }
+    if (rs == 1) {
+        for (int j = 0; j < N; ++j) {
+            const real* b = B + j * cs;
+            real* dst = B_packed + (j / nr) * nr * K + j % nr;
+            for (int p = 0; p < K; ++p)
+                dst[p * nr] = b[p];
+        }
+    } else {
+        for (int p = 0; p < K; ++p) {
+            const real* b = B + p * rs;
+            for (int j = 0; j < N; j += nr) {
+                int cols = min (nr, N - j);
+                real* dst = B_packed + j * K + p * nr;
+                for (int c = 0; c < cols; ++c)
+                    dst[c] = b[(j + c) * cs];
+            }
+        }
+    }
+}
+
 
-//                block_square_multilv1(lda, curM, curN, curK, A + i * lda + k, B + k * lda + j, C + i * lda + j);
+// The shipped tile shapes get their own copy of the packing loops with a
+// constant mr / nr, so the compiler can unroll them.
+static inline void pack_A(int M, int K, int mr, const real* restrict A, int rs, int cs, real alpha, int contig, real* restrict A_packed) {
+    if (contig) {
+        pack_A_contig(M, K, mr, A, rs, cs, alpha, A_packed);
+        return;
+    }
+    switch (mr) {
+        case 3 : pack_A_mr(M, K, 3, A, rs, cs, alpha, A_packed); break;
+        case 4 : pack_A_mr(M, K, 4, A, rs, cs, alpha, A_packed); break;
+        case 8 : pack_A_mr(M, K, 8, A, rs, cs, alpha, A_packed); break;
+        default : pack_A_mr(M, K, mr, A, rs, cs, alpha, A_packed);
+    }
+}
 
-                do_block_2(curM, curN, curK, A_padded, B_padded, C_padded);
 
+static inline void pack_B(int K, int N, int nr, const real* restrict B, int rs, int cs, int contig, int pf, real* restrict B_packed) {
+    if (contig) {
+        pack_B_contig(K, N, nr, B, rs, cs, B_packed);
+        return;
+    }
+    switch (nr) {
+        case 4 : pack_B_nr(K, N, 4, B, rs, cs, pf, B_packed); break;
+        case 16 : pack_B_nr(K, N, 16, B, rs, cs, pf, B_packed); break;
+        case 24 : pack_B_nr(K, N, 24, B, rs, cs, pf, B_packed); break;
+        default : pack_B_nr(K, N, nr, B, rs, cs, pf, B_packed);
+    }
+}
+
+
+// dst := beta * src for a rows x cols block; beta == 0 never reads src, so
+// NaNs in an uninitialised C don't leak through.
+static inline void scale_block(int rows, int cols, real beta, real* dst, int ld_dst, const real* src, int ld_src) {
+    if (beta == 1.0) {
+        copy_block(rows, cols, dst, ld_dst, (real*) src, ld_src);
+        return;
+    }
+    for (int ii = 0; ii < rows; ++ii) {
+        if (beta == 0.0)
+            memset(dst + ii * ld_dst, 0, sizeof(real) * cols);
+        else
+            for (int jj = 0; jj < cols; ++jj)
+                dst[ii * ld_dst + jj] = beta * src[ii * ld_src + jj];
+    }
+}
+
+
+// scale_block for rows of interleaved (re, im) pairs and a complex beta;
+// cols counts reals. dst may be src.
+static inline void scale_block_complex(int rows, int cols, real beta_r, real beta_i, real* dst, int ld_dst, const real* src, int ld_src) {
+    for (int ii = 0; ii < rows; ++ii)
+        for (int jj = 0; jj < cols; jj += 2) {
+            real re = src[ii * ld_src + jj];
+            real im = src[ii * ld_src + jj + 1];
+            dst[ii * ld_dst + jj] = beta_r * re - beta_i * im;
+            dst[ii * ld_dst + jj + 1] = beta_r * im + beta_i * re;
+        }
+}
+
+
+#ifndef SINGLE
+// dsgemm's float operands, widened to double as they are packed into the
+// pack_A_mr / pack_B_nr layouts.
+static void pack_A_mixed(int M, int K, int mr, const float* restrict A, int rs, int cs, double alpha, double* restrict A_packed) {
+    for (int i = 0; i < M; i += mr) {
+        int rows = min (mr, M - i);
+        const float* a = A + i * rs;
+        for (int p = 0; p < K; ++p) {
+            for (int r = 0; r < rows; ++r)
+                A_packed[r] = alpha * (double) a[r * rs + p * cs];
+            for (int r = rows; r < mr; ++r)
+                A_packed[r] = 0.0;
+            A_packed += mr;
+        }
+    }
+}
+
+
+static void pack_B_mixed(int K, int N, int nr, const float* restrict B, int rs, int cs, double* restrict B_packed) {
+    for (int j = 0; j < N; j += nr) {
+        int cols = min (nr, N - j);
+        const float* b = B + j * cs;
+        for (int p = 0; p < K; ++p) {
+            for (int c = 0; c < cols; ++c)
+                B_packed[c] = b[p * rs + c * cs];
+            for (int c = cols; c < nr; ++c)
+                B_packed[c] = 0.0;
+            B_packed += nr;
+        }
+    }
+}
+
+
+// zgemm runs as a real problem on the double kernels (the 1m method of
+// Van Zee and Smith). With op(A)(i, p) = ar + i ai and op(B)(p, j) =
+// br + i bi, and C read as rows of interleaved (re, im) doubles, i.e.
+// M x 2N real, C += A' * B' where A' is M x 2K and B' 2K x 2N:
+//   A'(i, 2p) = ar    A'(i, 2p + 1) = ai
+//   B'(2p, 2j) = br   B'(2p, 2j + 1) = bi
+//   B'(2p + 1, 2j) = -bi   B'(2p + 1, 2j + 1) = br
+// That is exactly the complex FLOP count. Both are packed straight from
+// the complex operands; K and N below count doubles and are even, the
+// strides count complex elements, and alpha is folded into A'.
+static void pack_A_complex(int M, int K, int mr, const double* restrict A, int rs, int cs, int conj,
+                           double alpha_r, double alpha_i, double* restrict A_packed) {
+    for (int i = 0; i < M; i += mr) {
+        int rows = min (mr, M - i);
+        const double* a = A + 2 * i * rs;
+        for (int p = 0; p < K / 2; ++p) {
+            for (int r = 0; r < rows; ++r) {
+                double re = a[2 * (r * rs + p * cs)];
+                double im = a[2 * (r * rs + p * cs) + 1];
+                if (conj)
+                    im = -im;
+                A_packed[r] = alpha_r * re - alpha_i * im;
+                A_packed[mr + r] = alpha_r * im + alpha_i * re;
+            }
+            for (int r = rows; r < mr; ++r) {
+                A_packed[r] = 0.0;
+                A_packed[mr + r] = 0.0;
             }
+            A_packed += 2 * mr;
+        }
+    }
+}
 
-//            for (int ii = 0; ii < curM; ++ii)
-//                for (int jj = 0; jj < curN; ++jj)
-//                    C[i_lda_plus_j + ii * lda + jj] = C_padded[ii][jj];
-
-//            for (int ii = 0; ii < curM; ++ii)
-//                memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN);
-
-            // ---------------
-            ii = 0;
-            block_limit = (curM / 8) * 8;
-            while (ii < block_limit) {
-                memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 1) * lda, C_padded[ii + 1], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 2) * lda, C_padded[ii + 2], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 3) * lda, C_padded[ii + 3], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 4) * lda, C_padded[ii + 4], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 5) * lda, C_padded[ii + 5], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 6) * lda, C_padded[ii + 6], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 7) * lda, C_padded[ii + 7], sizeof(double) * curN);
-                ii += 8;
+
+static void pack_B_complex(int K, int N, int nr, const double* restrict B, int rs, int cs, int conj, double* restrict B_packed) {
+    for (int j = 0; j < N; j += nr) {
+        int cols = min (nr, N - j);
+        const double* b = B + j * cs;
+        for (int p = 0; p < K / 2; ++p) {
+            double* re_row = B_packed;
+            double* im_row = B_packed + nr;
+            for (int c = 0; c < cols / 2; ++c) {
+                double re = b[2 * (p * rs + c * cs)];
+                double im = b[2 * (p * rs + c * cs) + 1];
+                if (conj)
+                    im = -im;
+                re_row[2 * c] = re;
+                re_row[2 * c + 1] = im;
+                im_row[2 * c] = -im;
+                im_row[2 * c + 1] = re;
             }
-            if (ii < curM) {
-                switch (curM - ii) {
-                    case 7 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 6 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 5 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 4 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 3 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 2 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 1 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN);
-                }
+            for (int c = cols; c < nr; ++c) {
+                re_row[c] = 0.0;
+                im_row[c] = 0.0;
             }
-            // ---------------
+            B_packed += 2 * nr;
         }
     }
 }
+#endif
+
+
+// How A and B are stored
+enum { GEMM_REAL, GEMM_MIXED, GEMM_COMPLEX };
+
+// One row-major problem C := alpha * op(A) * op(B) + beta * C, with op()
+// folded into the strides: op(A)(i, p) = A[i * rs_a + p * cs_a] and
+// op(B)(p, j) = B[p * rs_b + j * cs_b].
+// GEMM_MIXED (dsgemm) has float A and B. GEMM_COMPLEX (zgemm) is run as
+// the real problem of pack_A_complex: N, K and ldc count doubles, the A
+// and B strides complex elements, and alpha_i / beta_i are the imaginary
+// parts of the scalars, zero otherwise.
+typedef struct {
+    int M, N, K;
+    real alpha, alpha_i;
+    const void* A;
+    int rs_a, cs_a;
+    const void* B;
+    int rs_b, cs_b;
+    real beta, beta_i;
+    real* C;
+    int ldc;
+    int format;
+    int conj_a, conj_b;
+    const dgemm_packed* packed_a;   // prepacked operands, used instead of A / B; see dgemm_pack_b
+    const dgemm_packed* packed_b;
+} gemm_args;
+
+
+// A dgemm_pack_a / dgemm_pack_b handle: this header, then at PACKED_HEADER
+// bytes the operand's panels, in the order and layout pack_A_panel /
+// pack_B_panel write them for its kernel and block sizes. PACKED_VERSION
+// changes with either. dgemm_packed_save writes the same bytes to a file,
+// with kernel and map_bytes cleared, and dgemm_packed_map maps them back.
+#define PACKED_MAGIC 0x6b636170
+#define PACKED_VERSION 2
+
+struct dgemm_packed {
+    int magic;
+    int version;
+    int header_bytes;       // PACKED_HEADER, where the panels start
+    int alignment;          // of the panels, ALIGNMENT
+    int elem_size;          // sizeof(real), so sgemm and dgemm handles don't mix
+    int layout;             // of the pack call; compute calls must use the same
+    int operand;            // what the caller packed: 0 A, 1 B
+    int side;               // what that is in the row-major problem: 0 A (m x k), 1 B (k x m)
+    int m, k;               // its free dimension and K
+    real alpha;             // folded into a packed A, applied to the A packed against a B
+    dgemm_blocking b;       // block sizes it was packed with
+    char kernel_name[32];
+    char isa[16];           // the kernel's, for whoever reads the file
+    size_t elems;           // packed elements after the header
+    const micro_kernel* kernel;
+    size_t map_bytes;       // length of the mapping of a dgemm_packed_map handle, 0 otherwise
+};
+
+#define PACKED_HEADER round_up(sizeof(struct dgemm_packed), ALIGNMENT)
+
+
+static inline real* packed_data(const dgemm_packed* p) {
+    return (real*) ((char*) p + PACKED_HEADER);
+}
 
 
-// M = REGA = 3, N = REGB*256/64 = 16
-// for block1, M = 3, N = 16, which means all c00-c13 are stored in C
-// K changeable
-static inline void avx_kernel_small(int K, double* restrict A, double* restrict B, double* restrict C) {
-    register __m256d c00, c01, c02, c03;
-    register __m256d c10, c11, c12, c13;
-    register __m256d c20, c21, c22, c23;
-    //totally 3*4*4 = 48 8float/per refresh
-    //__m256d zero = _mm256_set1_pd(0.0);
-    c00 = _mm256_loadu_pd(&C[0 * BLOCK_SIZE2_SMALL + 0]);
-    c01 = _mm256_loadu_pd(&C[0 * BLOCK_SIZE2_SMALL + 4]);
-    c02 = _mm256_loadu_pd(&C[0 * BLOCK_SIZE2_SMALL + 8]);
-    c03 = _mm256_loadu_pd(&C[0 * BLOCK_SIZE2_SMALL + 12]);
-    c10 = _mm256_loadu_pd(&C[1 * BLOCK_SIZE2_SMALL + 0]);
-    c11 = _mm256_loadu_pd(&C[1 * BLOCK_SIZE2_SMALL + 4]);
-    c12 = _mm256_loadu_pd(&C[1 * BLOCK_SIZE2_SMALL + 8]);
-    c13 = _mm256_loadu_pd(&C[1 * BLOCK_SIZE2_SMALL + 12]);
-    c20 = _mm256_loadu_pd(&C[2 * BLOCK_SIZE2_SMALL + 0]);
-    c21 = _mm256_loadu_pd(&C[2 * BLOCK_SIZE2_SMALL + 4]);
-    c22 = _mm256_loadu_pd(&C[2 * BLOCK_SIZE2_SMALL + 8]);
-    c23 = _mm256_loadu_pd(&C[2 * BLOCK_SIZE2_SMALL + 12]);
+// The packed slab of rows i.. (side 0) or panel of columns i.. (side 1)
+// at depth k: the row / column blocks are mc / nc wide, and each holds its
+// kc panels one after the other.
+static inline real* packed_panel(const dgemm_packed* p, int i, int k) {
+    int outer = p->side ? p->b.nc : p->b.mc;
+    int tile = p->side ? p->kernel->nr : p->kernel->mr;
+    return packed_data(p) + (size_t) (i / outer) * p->k * round_up(outer, tile)
+        + (size_t) k * round_up(min (outer, p->m - i), tile);
+}
 
-    for(int p = 0; p < K; ++p){
-        register __m256d a1 = _mm256_broadcast_sd(&A[0*BLOCK_SIZE2_SMALL+p]);
-        register __m256d a2 = _mm256_broadcast_sd(&A[1*BLOCK_SIZE2_SMALL+p]);
-        register __m256d a3 = _mm256_broadcast_sd(&A[2*BLOCK_SIZE2_SMALL+p]);
 
-        register __m256d b = _mm256_loadu_pd(&B[p*BLOCK_SIZE2_SMALL + 0*8]);
-        c00 = _mm256_fmadd_pd(a1,b,c00);
-        c10 = _mm256_fmadd_pd(a2,b,c10);
-        c20 = _mm256_fmadd_pd(a3,b,c20);
+// Tiny problems with row-major op(B) skip packing, see do_small_direct
+static inline int small_direct(const gemm_args* args) {
+    return args->format == GEMM_REAL && args->M <= SMALL_DIRECT && args->N <= SMALL_DIRECT && args->K <= SMALL_DIRECT
+        && args->cs_b == 1 && !args->packed_a && !args->packed_b;
+}
 
-        b = _mm256_loadu_pd(&B[p*BLOCK_SIZE2_SMALL + 4 + 0*8]);
-        c01 = _mm256_fmadd_pd(a1,b,c01);
-        c11 = _mm256_fmadd_pd(a2,b,c11);
-        c21 = _mm256_fmadd_pd(a3,b,c21);
 
-        b = _mm256_loadu_pd(&B[p*BLOCK_SIZE2_SMALL + 0 + 1*8]);
-        c02 = _mm256_fmadd_pd(a1,b,c02);
-        c12 = _mm256_fmadd_pd(a2,b,c12);
-        c22 = _mm256_fmadd_pd(a3,b,c22);
+static inline int scales_C(const gemm_args* args) {
+    return args->beta != 1.0 || args->beta_i != 0.0;
+}
 
-        b = _mm256_loadu_pd(&B[p*BLOCK_SIZE2_SMALL + 4 + 1*8]);
-        c03 = _mm256_fmadd_pd(a1,b,c03);
-        c13 = _mm256_fmadd_pd(a2,b,c13);
-        c23 = _mm256_fmadd_pd(a3,b,c23);
-    }
 
+// dst := beta * src, for a block of C
+static inline void scale_C(const gemm_args* args, int rows, int cols, real* dst, int ld_dst, const real* src, int ld_src) {
+    if (args->beta_i != 0.0)
+        scale_block_complex(rows, cols, args->beta, args->beta_i, dst, ld_dst, src, ld_src);
+    else
+        scale_block(rows, cols, args->beta, dst, ld_dst, src, ld_src);
+}
 
-    _mm256_storeu_pd(&C[0], c00);
-    _mm256_storeu_pd(&C[4], c01);
 
-    _mm256_storeu_pd(&C[8], c02);
-    _mm256_storeu_pd(&C[12], c03);
+// Switches an operand to the contiguous packing loops when its strided
+// walk would crowd L1, i.e. put more lines in one set than half its ways.
+// That is what a power-of-two leading dimension does: the mr rows read per
+// column of a row-major A, the nr columns per row of a transposed B, or
+// the kc lines a sliver touches and the next one reuses all map to a
+// single set. 511, 512 and 513 then pack at the same rate.
+// C is only copied through C_padded (whose leading dimension is skewed)
+// when ldc would do the same to the kernel's mr rows in L1 or the mc rows
+// of the slab in L2; otherwise the kernels, edge tiles included, update C
+// in place, which saves a copy in and out per k panel.
+static inline void plan_packing(blocking* blk, const gemm_args* args) {
+    if (args->format == GEMM_COMPLEX) {
+        // Keep (re, im) pairs within one kc / nc block
+        blk->kc = round_up(blk->kc, 2);
+        blk->nc = round_up(blk->nc, 2);
+        blk->ld_c = skew_ld(blk->nc);
+    }
 
-    _mm256_storeu_pd(&C[BLOCK_SIZE2_SMALL], c10);
-    _mm256_storeu_pd(&C[BLOCK_SIZE2_SMALL + 4], c11);
+    const cache_level* l1 = &host_caches()->l1d;
+    const cache_level* l2 = &host_caches()->l2;
+    int limit = l1->ways > 1 ? l1->ways / 2 : 1;
+    int limit2 = l2->ways > 1 ? l2->ways / 2 : 1;
+    long d = sizeof(real);
+    blk->direct_c = l1->size > 0 && l2->size > 0
+        && cache_set_load(l1, args->ldc * d, blk->kernel->mr) <= limit
+        && cache_set_load(l2, args->ldc * d, min (blk->mc, args->M)) <= limit2;
 
-    _mm256_storeu_pd(&C[BLOCK_SIZE2_SMALL + 8], c12);
-    _mm256_storeu_pd(&C[BLOCK_SIZE2_SMALL + 12], c13);
+    if (args->format != GEMM_REAL || small_direct(args))
+        return;
 
-    _mm256_storeu_pd(&C[2 * BLOCK_SIZE2_SMALL], c20);
-    _mm256_storeu_pd(&C[2 * BLOCK_SIZE2_SMALL + 4], c21);
+    int kc = min (blk->kc, args->K);
 
-    _mm256_storeu_pd(&C[2 * BLOCK_SIZE2_SMALL + 8], c22);
-    _mm256_storeu_pd(&C[2 * BLOCK_SIZE2_SMALL + 12], c23);
+    if (args->cs_a == 1)
+        blk->contig_a = cache_set_load(l1, args->rs_a * d, blk->kernel->mr) > limit;
+    else
+        blk->contig_a = cache_set_load(l1, args->cs_a * d, kc) > limit;
+    if (args->rs_b == 1)
+        blk->contig_b = cache_set_load(l1, args->cs_b * d, blk->kernel->nr) > limit;
+    else
+        blk->contig_b = cache_set_load(l1, args->rs_b * d, kc) > limit;
 }
 
 
+// Packs op(A)[i:i+curM, k:k+curK], scaled by alpha, into A_packed
+static inline void pack_A_panel(const blocking* blk, const gemm_args* args, int i, int k, int curM, int curK, real* restrict A_packed) {
+    int mr = blk->kernel->mr;
+#ifndef SINGLE
+    if (args->format == GEMM_MIXED) {
+        pack_A_mixed(curM, curK, mr, (const float*) args->A + i * args->rs_a + k * args->cs_a, args->rs_a, args->cs_a,
+                     args->alpha, A_packed);
+        return;
+    }
+    if (args->format == GEMM_COMPLEX) {
+        pack_A_complex(curM, curK, mr, (const double*) args->A + 2 * (i * args->rs_a + k / 2 * args->cs_a), args->rs_a, args->cs_a,
+                       args->conj_a, args->alpha, args->alpha_i, A_packed);
+        return;
+    }
+#endif
+    pack_A(curM, curK, mr, (const real*) args->A + i * args->rs_a + k * args->cs_a, args->rs_a, args->cs_a, args->alpha,
+           blk->contig_a, A_packed);
+}
 
-static inline void do_block_1_small(int M, int N, int K, double* restrict A_padded, double* restrict B_padded, double* restrict C_padded) {
-    for (int i = 0; i < M; i += REG_BLOCK_SIZE_M_SMALL)
-        for (int j = 0; j < N; j += REG_BLOCK_SIZE_N_SMALL)
-            for (int k = 0; k < K; k += REG_BLOCK_SIZE_K_SMALL) {
-                int curK = min (REG_BLOCK_SIZE_K_SMALL, K - k);
 
-                avx_kernel_small(curK,
-                           A_padded + i * BLOCK_SIZE2_SMALL + k,
-                           B_padded + k * BLOCK_SIZE2_SMALL + j,
-                           C_padded + i * BLOCK_SIZE2_SMALL + j);
-            }
+// The packed (i, k) slab of A: the prepacked one, or buf once it is
+// packed there
+static inline real* A_slab(const blocking* blk, const gemm_args* args, int i, int k, int curM, int curK, real* buf) {
+    if (args->packed_a)
+        return packed_panel(args->packed_a, i, k);
+    pack_A_panel(blk, args, i, k, curM, curK, buf);
+    return buf;
 }
 
 
-static inline void do_block_2_small(int M, int N, int K, double* restrict A_padded, double* restrict B_padded, double* restrict C_padded) {
+// C[i:i+curM, j:j+curN] (+)= alpha * A[i:i+curM, k:k+curK] * B_packed, where
+// B_packed already holds the packed (k, j) panel of B. beta is applied
+// for the first k panel, in place or while C is copied in.
+static inline void do_row_block(const blocking* blk, const gemm_args* args, int i, int j, int k, int curM, int curN, int curK,
+                                real* restrict B_packed, real* restrict A_packed, real* restrict C_padded) {
+    int ld = blk->ld_c;
+    real* C = args->C + i * args->ldc + j;
+
+    A_packed = A_slab(blk, args, i, k, curM, curK, A_packed);
+    if (blk->direct_c) {
+        if (k == 0 && scales_C(args))
+            scale_C(args, curM, curN, C, args->ldc, C, args->ldc);
+        do_block_2(blk, curM, curN, curK, A_packed, B_packed, C, args->ldc);
+        return;
+    }
+    if (k == 0)
+        scale_C(args, curM, curN, C_padded, ld, C, args->ldc);
+    else
+        copy_block(curM, curN, C_padded, ld, C, args->ldc);
 
-    for (int i = 0; i < M; i += L1_BLOCK_SIZE_M_SMALL) {
-        int curM = min (L1_BLOCK_SIZE_M_SMALL, M - i);
+    do_block_2(blk, curM, curN, curK, A_packed, B_packed, C_padded, ld);
 
-        for (int j = 0; j < N; j += L1_BLOCK_SIZE_N_SMALL) {
-            int curN = min (L1_BLOCK_SIZE_N_SMALL, N - j);
+    copy_block(curM, curN, C, args->ldc, C_padded, ld);
+}
 
-            for (int k = 0; k < K; k += L1_BLOCK_SIZE_K_SMALL) {
-                int curK = min (L1_BLOCK_SIZE_K_SMALL, K - k);
 
-                do_block_1_small(curM, curN, curK,
-                           A_padded + i * BLOCK_SIZE2_SMALL + k,
-                           B_padded + k * BLOCK_SIZE2_SMALL + j,
-                           C_padded + i * BLOCK_SIZE2_SMALL + j);
-            }
-        }
+static inline void pack_B_panel(const blocking* blk, const gemm_args* args, int j, int k, int curN, int curK, real* restrict B_packed) {
+    int nr = blk->kernel->nr;
+#ifndef SINGLE
+    if (args->format == GEMM_MIXED) {
+        pack_B_mixed(curK, curN, nr, (const float*) args->B + k * args->rs_b + j * args->cs_b, args->rs_b, args->cs_b, B_packed);
+        return;
     }
+    if (args->format == GEMM_COMPLEX) {
+        pack_B_complex(curK, curN, nr, (const double*) args->B + 2 * (k / 2 * args->rs_b) + j * args->cs_b, args->rs_b, args->cs_b,
+                       args->conj_b, B_packed);
+        return;
+    }
+#endif
+    pack_B(curK, curN, nr, (const real*) args->B + k * args->rs_b + j * args->cs_b, args->rs_b, args->cs_b,
+           blk->contig_b, blk->pf_b, B_packed);
 }
 
 
-static inline void do_matrix_small(int lda, double* restrict A, double* restrict B, double* restrict C) {
-    double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) C_padded[BLOCK_SIZE2_SMALL][BLOCK_SIZE2_SMALL] = {0};
-    double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) A_padded[BLOCK_SIZE2_SMALL][BLOCK_SIZE2_SMALL] = {0};
-    double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) B_padded[BLOCK_SIZE2_SMALL][BLOCK_SIZE2_SMALL] = {0};
+// The packed (k, j) panel of B: the prepacked one, or buf once it is
+// packed there
+static inline real* B_panel(const blocking* blk, const gemm_args* args, int j, int k, int curN, int curK, real* buf) {
+    if (args->packed_b)
+        return packed_panel(args->packed_b, j, k);
+    pack_B_panel(blk, args, j, k, curN, curK, buf);
+    return buf;
+}
+
+
+// Runs the kernel's unpacked small path over C.
+static inline void do_small_direct(const blocking* blk, const gemm_args* args) {
+    if (args->beta != 1.0)
+        scale_block(args->M, args->N, args->beta, args->C, args->ldc, args->C, args->ldc);
+    blk->kernel->small(args->M, args->N, args->K, args->alpha, (const real*) args->A, args->rs_a, args->cs_a,
+                       (const real*) args->B, args->rs_b, args->C, args->ldc);
+}
 
-//    block_square_multilv2(lda, lda, lda, lda, A, B, C, A_padded, B_padded, C_padded);
 
-    for (int i = 0; i < lda; i += BLOCK_SIZE2_SMALL) {
-        int curM = min (BLOCK_SIZE2_SMALL, lda - i);
+// A problem that fits in one row slab and one B panel skips C_padded:
+// beta is applied in place and the kernels accumulate straight into C.
+static inline void do_single_block(const blocking* blk, const gemm_args* args, workspace* ws) {
+    real* B_packed = B_panel(blk, args, 0, 0, args->N, args->K, ws->B_packed);
+    real* A_packed = A_slab(blk, args, 0, 0, args->M, args->K, ws->A_packed);
+    if (scales_C(args))
+        scale_C(args, args->M, args->N, args->C, args->ldc, args->C, args->ldc);
 
-        for (int j = 0; j < lda; j += BLOCK_SIZE2_SMALL) {
-            int curN = min (BLOCK_SIZE2_SMALL, lda - j);
+    do_block_2(blk, args->M, args->N, args->K, A_packed, B_packed, args->C, args->ldc);
+}
 
-//            double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) C_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
 
-//            if (curN != BLOCK_SIZE2) {
-//                memset(C_padded, 0, sizeof(double) * BLOCK_SIZE2 * BLOCK_SIZE2);
-//            }
+// GotoBLAS loop order (jc -> pc -> ic): each (k, j) panel of B is packed
+// once and reused by every row block of A, instead of being re-packed for
+// each i. ws is the calling thread's workspace, sized for blk.
+static inline void do_matrix(const blocking* blk, const gemm_args* args, workspace* ws) {
+    if (small_direct(args)) {
+        do_small_direct(blk, args);
+        return;
+    }
+    if (args->M <= blk->mc && args->N <= blk->nc && args->K <= blk->kc) {
+        do_single_block(blk, args, ws);
+        return;
+    }
 
-            int i_lda = i * lda;
-            int i_lda_plus_j = i_lda + j;
+    for (int j = 0; j < args->N; j += blk->nc) {
+        int curN = min (blk->nc, args->N - j);
 
-//            for (int ii = 0; ii < curM; ++ii)
-//                for (int jj = 0; jj < curN; ++jj)
-//                    C_padded[ii][jj] = C[i_lda_plus_j + ii * lda + jj];
+        for (int k = 0; k < args->K; k += blk->kc) {
+            int curK = min (blk->kc, args->K - k);
 
-//            for (int ii = 0; ii < curM; ++ii)
-//                memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN);
+            real* B_packed = B_panel(blk, args, j, k, curN, curK, ws->B_packed);
 
-            // ---------------
-            int ii = 0;
-            int block_limit = (curM / 8) * 8;
-            while (ii < block_limit) {
-                memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 1], C + i_lda_plus_j + (ii + 1) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 2], C + i_lda_plus_j + (ii + 2) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 3], C + i_lda_plus_j + (ii + 3) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 4], C + i_lda_plus_j + (ii + 4) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 5], C + i_lda_plus_j + (ii + 5) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 6], C + i_lda_plus_j + (ii + 6) * lda, sizeof(double) * curN);
-                memcpy(C_padded[ii + 7], C + i_lda_plus_j + (ii + 7) * lda, sizeof(double) * curN);
-                ii += 8;
-            }
-            if (ii < curM) {
-                switch (curM - ii) {
-                    case 7 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 6 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 5 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 4 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 3 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 2 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN); ii++;
-                    case 1 : memcpy(C_padded[ii], C + i_lda_plus_j + ii * lda, sizeof(double) * curN);
+            for (int i = 0; i < args->M; i += blk->mc)
+                do_row_block(blk, args, i, j, k, min (blk->mc, args->M - i), curN, curK,
+                             B_packed, ws->A_packed, ws->C_padded);
+        }
+    }
+}
+
+
+#ifdef PARALLEL
+// One (k, j) panel of B and where it is packed
+typedef struct {
+    int j, k;
+    int curN, curK;
+    real* B_packed[POOL_MAX_NODES];   // one copy per node, shared by its workers
+} panel;
+
+typedef struct {
+    const blocking* blk;
+    const gemm_args* args;
+    int nodes;
+    int row_blocks;
+    panel cur;      // the row slabs are multiplied against this one
+    panel next;     // pipelined: packed by the tasks after the row slabs; curN == 0 if none
+} panel_job;
+
+
+// With the pool spread over several NUMA nodes, each node gets its own
+// copy of the B panel in its own memory, so the kernels never stream B
+// across the interconnect; otherwise the one copy is B_packed, or B_next
+// for the second buffer (buf 1) of the pipelined loop.
+static int node_panels(const blocking* blk, workspace* ws, int buf, real* B_packed[POOL_MAX_NODES]) {
+    size_t n = (size_t) blk->kc * round_up(blk->nc, blk->kernel->nr);
+    B_packed[0] = buf ? reserve(&ws->B_next, &ws->B_next_size, n) : ws->B_packed;
+    int nodes = pool_num_nodes();
+#ifdef NUMA
+    if (nodes > 1) {
+        for (int node = 0; node < nodes; ++node) {
+            if (ws->B_node_size[buf][node] < n) {
+                if (ws->B_node[buf][node])
+                    numa_free(ws->B_node[buf][node], sizeof(real) * ws->B_node_size[buf][node]);
+                ws->B_node[buf][node] = (real*) numa_alloc_onnode(sizeof(real) * n, pool_node_id(node));
+                if (!ws->B_node[buf][node]) {
+                    fprintf(stderr, "dgemm: failed to allocate %zu byte panel on node %d\n",
+                            sizeof(real) * n, pool_node_id(node));
+                    abort();
                 }
+                ws->B_node_size[buf][node] = n;
             }
-            // ---------------
-
-            for (int k = 0; k < lda; k += BLOCK_SIZE2_SMALL) {
-                int i_lda_plus_k = i_lda + k;
-                int k_lda_plus_j = k * lda + j;
-
-                int curK = min (BLOCK_SIZE2_SMALL, lda - k);
-
-//                double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) A_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
-//                double __attribute__(( aligned(__BIGGEST_ALIGNMENT__))) B_padded[BLOCK_SIZE2][BLOCK_SIZE2] = {0};
-//                memset(A_padded, 0, sizeof(double) * BLOCK_SIZE2 * BLOCK_SIZE2);
-//                memset(B_padded, 0, sizeof(double) * BLOCK_SIZE2 * BLOCK_SIZE2);
-
-//                for (int ii = 0; ii < curM; ++ii)
-//                    for (int kk = 0; kk < curK; ++kk)
-//                        A_padded[ii][kk] = A[i_lda_plus_k + ii * lda + kk];
-
-//                for (int ii = 0; ii < curM; ++ii) {
-//                    memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK);
-//                }
-
-                // ---------------
-                int ii = 0;
-                int block_limit = (curM / 8) * 8;
-                while (ii < block_limit) {
-                    memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 1], A + i_lda_plus_k + (ii + 1) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 2], A + i_lda_plus_k + (ii + 2) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 3], A + i_lda_plus_k + (ii + 3) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 4], A + i_lda_plus_k + (ii + 4) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 5], A + i_lda_plus_k + (ii + 5) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 6], A + i_lda_plus_k + (ii + 6) * lda, sizeof(double) * curK);
-                    memcpy(A_padded[ii + 7], A + i_lda_plus_k + (ii + 7) * lda, sizeof(double) * curK);
-                    ii += 8;
-                }
-                if (ii < curM) {
-                    switch (curM - ii) {
-                        case 7 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 6 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 5 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 4 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 3 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 2 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK); ii++;
-                        case 1 : memcpy(A_padded[ii], A + i_lda_plus_k + ii * lda, sizeof(double) * curK);
-                    }
-                }
-                // ---------------
-
-//                for (int kk = 0; kk < curK; ++kk)
-//                    for (int jj = 0; jj < curN; ++jj)
-//                        B_padded[kk][jj] = B[k_lda_plus_j + kk * lda + jj];
-
-//                for (int kk = 0; kk < curK; ++kk)
-//                    memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN);
-
-                // ---------------
-                int kk = 0;
-                block_limit = (curK / 8) * 8;
-                while (kk < block_limit) {
-                    memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 1], B + k_lda_plus_j + (kk + 1) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 2], B + k_lda_plus_j + (kk + 2) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 3], B + k_lda_plus_j + (kk + 3) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 4], B + k_lda_plus_j + (kk + 4) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 5], B + k_lda_plus_j + (kk + 5) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 6], B + k_lda_plus_j + (kk + 6) * lda, sizeof(double) * curN);
-                    memcpy(B_padded[kk + 7], B + k_lda_plus_j + (kk + 7) * lda, sizeof(double) * curN);
-                    kk += 8;
-                }
-                if (kk < curK) {
-                    switch (curK - kk) {
-                        case 7 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 6 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 5 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 4 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 3 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 2 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                        case 1 : memcpy(B_padded[kk], B + k_lda_plus_j + kk * lda, sizeof(double) * curN); kk++;
-                    }
-                }
-                // ---------------
+            B_packed[node] = ws->B_node[buf][node];
+        }
+    }
+#endif
+    return nodes;
+}
 
-//                block_square_multilv1(lda, curM, curN, curK, A + i * lda + k, B + k * lda + j, C + i * lda + j);
 
-                do_block_2_small(curM, curN, curK, A_padded, B_padded, C_padded);
+// Tasks to pack p: one per nr-column sliver of each node's copy
+static inline int pack_tasks(const panel_job* job, const panel* p) {
+    int nr = job->blk->kernel->nr;
+    return job->nodes * ((p->curN + nr - 1) / nr);
+}
 
-            }
 
-//            for (int ii = 0; ii < curM; ++ii)
-//                for (int jj = 0; jj < curN; ++jj)
-//                    C[i_lda_plus_j + ii * lda + jj] = C_padded[ii][jj];
-
-//            for (int ii = 0; ii < curM; ++ii)
-//                memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN);
-
-            // ---------------
-            ii = 0;
-            block_limit = (curM / 8) * 8;
-            while (ii < block_limit) {
-                memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 1) * lda, C_padded[ii + 1], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 2) * lda, C_padded[ii + 2], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 3) * lda, C_padded[ii + 3], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 4) * lda, C_padded[ii + 4], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 5) * lda, C_padded[ii + 5], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 6) * lda, C_padded[ii + 6], sizeof(double) * curN);
-                memcpy(C + i_lda_plus_j + (ii + 7) * lda, C_padded[ii + 7], sizeof(double) * curN);
-                ii += 8;
+// Packs sliver t % slivers of node t / slivers's copy of p; the contiguous
+// task slices mostly have a node's workers pack its copy.
+static inline void pack_B_task(const panel_job* job, const panel* p, int t) {
+    int nr = job->blk->kernel->nr;
+    int slivers = (p->curN + nr - 1) / nr;
+    int jj = t % slivers * nr;
+    pack_B_panel(job->blk, job->args, p->j + jj, p->k, min (nr, p->curN - jj), p->curK,
+                 p->B_packed[t / slivers] + jj * p->curK);
+}
+
+
+static void pack_B_worker(void* arg, int worker) {
+    panel_job* job = (panel_job*) arg;
+    int t;
+    while ((t = pool_next_task(worker)) >= 0)
+        pack_B_task(job, &job->cur, t);
+}
+
+
+// Runs on every pool worker: each one uses its own workspace's A/C and pulls
+// row slabs against its node's B panel, stealing the ragged last slab
+// from slower workers instead of waiting on them. The contiguous task
+// slices give each node one band of C's rows. Pipelined, the tasks after
+// the row slabs pack the next panel: whichever workers get to them pack
+// while the others still multiply, and stealing evens it out.
+static void do_panel_worker(void* arg, int worker) {
+    panel_job* job = (panel_job*) arg;
+    workspace* ws = get_workspace(job->blk);
+    real* B_packed = job->cur.B_packed[pool_worker_node(worker)];
+
+    int t;
+    while ((t = pool_next_task(worker)) >= 0) {
+        if (t >= job->row_blocks) {
+            pack_B_task(job, &job->next, t - job->row_blocks);
+            continue;
+        }
+        int i = t * job->blk->mc;
+        do_row_block(job->blk, job->args, i, job->cur.j, job->cur.k, min (job->blk->mc, job->args->M - i),
+                     job->cur.curN, job->cur.curK, B_packed, ws->A_packed, ws->C_padded);
+    }
+}
+
+
+// Same jc -> pc -> ic order as do_matrix, with the ic loop spread over the
+// pool. The first B panel is packed by all workers together; after that
+// each pool_run multiplies against one panel while packing the next into
+// the other buffer, so packing overlaps the kernels and there is one
+// barrier per panel instead of two.
+static inline void do_matrix_parallel(const blocking* blk, const gemm_args* args) {
+    workspace* ws = get_workspace(blk);
+
+    panel_job job;
+    job.blk = blk;
+    job.args = args;
+    job.row_blocks = (args->M + blk->mc - 1) / blk->mc;
+    job.nodes = node_panels(blk, ws, 0, job.cur.B_packed);
+    if (pipeline && !args->packed_b)
+        node_panels(blk, ws, 1, job.next.B_packed);
+
+    for (int j = 0; j < args->N; j += blk->nc) {
+        for (int k = 0; k < args->K; k += blk->kc) {
+            job.cur.j = j;
+            job.cur.k = k;
+            job.cur.curN = min (blk->nc, args->N - j);
+            job.cur.curK = min (blk->kc, args->K - k);
+
+            if (args->packed_b) {
+                // Prepacked: nothing to pack, and every node reads the one copy
+                for (int node = 0; node < job.nodes; ++node)
+                    job.cur.B_packed[node] = packed_panel(args->packed_b, j, k);
+                job.next.curN = 0;
+                pool_run(job.row_blocks, do_panel_worker, &job);
+                continue;
             }
-            if (ii < curM) {
-                switch (curM - ii) {
-                    case 7 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 6 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 5 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 4 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 3 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 2 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN); ii++;
-                    case 1 : memcpy(C + i_lda_plus_j + ii * lda, C_padded[ii], sizeof(double) * curN);
-                }
+
+            if (!pipeline) {
+                pool_run(pack_tasks(&job, &job.cur), pack_B_worker, &job);
+                pool_run(job.row_blocks, do_panel_worker, &job);
+                continue;
             }
-            // ---------------
+
+            if (j == 0 && k == 0)
+                pool_run(pack_tasks(&job, &job.cur), pack_B_worker, &job);
+            job.next.k = k + blk->kc < args->K ? k + blk->kc : 0;
+            job.next.j = job.next.k ? j : j + blk->nc;
+            job.next.curN = job.next.j < args->N ? min (blk->nc, args->N - job.next.j) : 0;
+            job.next.curK = min (blk->kc, args->K - job.next.k);
+            pool_run(job.row_blocks + pack_tasks(&job, &job.next), do_panel_worker, &job);
+
+            // The next panel is now packed: swap the buffers
+            real* spare[POOL_MAX_NODES];
+            memcpy(spare, job.cur.B_packed, sizeof(spare));
+            memcpy(job.cur.B_packed, job.next.B_packed, sizeof(spare));
+            memcpy(job.next.B_packed, spare, sizeof(spare));
+        }
+    }
+}
+
+
+void dgemm_set_num_threads(int nthreads) {
+    pool_set_num_threads(nthreads);
+}
+#endif
+
+
+static void xerbla(const char* name, int arg) {
+    fprintf(stderr, "%s: parameter %d had an illegal value\n", name, arg);
+}
+
+
+// Checks the arguments of a dgemm-style call and fills in args, with the
+// layout and transposes folded into the operand strides. ld_pos gives the
+// parameter numbers of lda, ldb and ldc for the error message. Returns
+// nonzero if an argument is illegal. args is a GEMM_REAL problem; the
+// conjugations are recorded for zgemm.
+static int make_args(gemm_args* args, const char* name, const int ld_pos[3],
+                     enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                     int M, int N, int K, real alpha, const void* A, int lda,
+                     const void* B, int ldb, real beta, real* C, int ldc) {
+    int notransA = transA == DgemmNoTrans;
+    int notransB = transB == DgemmNoTrans;
+    int conjA = transA == DgemmConjTrans;
+    int conjB = transB == DgemmConjTrans;
+    int col = layout == DgemmColMajor;
+
+    if (layout != DgemmRowMajor && !col) { xerbla(name, 1); return 1; }
+    if (!notransA && transA != DgemmTrans && transA != DgemmConjTrans) { xerbla(name, 2); return 1; }
+    if (!notransB && transB != DgemmTrans && transB != DgemmConjTrans) { xerbla(name, 3); return 1; }
+    if (M < 0) { xerbla(name, 4); return 1; }
+    if (N < 0) { xerbla(name, 5); return 1; }
+    if (K < 0) { xerbla(name, 6); return 1; }
+
+    // A column-major C = op(A) op(B) is the row-major C^T = op(B)^T op(A)^T
+    if (col) {
+        int t = M; M = N; N = t;
+        const void* p = A; A = B; B = p;
+        t = lda; lda = ldb; ldb = t;
+        t = notransA; notransA = notransB; notransB = t;
+        t = conjA; conjA = conjB; conjB = t;
+    }
+
+    // Row-major storage of op(A) (M x K) and op(B) (K x N)
+    if (lda < (notransA ? K : M) || lda < 1) { xerbla(name, ld_pos[col]); return 1; }
+    if (ldb < (notransB ? N : K) || ldb < 1) { xerbla(name, ld_pos[!col]); return 1; }
+    if (ldc < N || ldc < 1) { xerbla(name, ld_pos[2]); return 1; }
+
+    args->M = M;
+    args->N = N;
+    args->K = K;
+    args->alpha = alpha;
+    args->alpha_i = 0.0;
+    args->A = A;
+    args->rs_a = notransA ? lda : 1;
+    args->cs_a = notransA ? 1 : lda;
+    args->B = B;
+    args->rs_b = notransB ? ldb : 1;
+    args->cs_b = notransB ? 1 : ldb;
+    args->beta = beta;
+    args->beta_i = 0.0;
+    args->C = C;
+    args->ldc = ldc;
+    args->format = GEMM_REAL;
+    args->conj_a = conjA;
+    args->conj_b = conjB;
+    args->packed_a = NULL;
+    args->packed_b = NULL;
+    return 0;
+}
+
+
+// Handles the problems with no multiply to do (empty C, alpha == 0 or
+// K == 0); returns nonzero if args was one of them.
+static int trivial(const gemm_args* args) {
+    if (args->M == 0 || args->N == 0)
+        return 1;
+    if ((args->alpha == 0.0 && args->alpha_i == 0.0) || args->K == 0) {
+        if (scales_C(args))
+            scale_C(args, args->M, args->N, args->C, args->ldc, args->C, args->ldc);
+        return 1;
+    }
+    return 0;
+}
+
+
+// Runs one checked, non-trivial problem with the block sizes in blk
+static void run_blocked(blocking* blk, const gemm_args* args) {
+    plan_packing(blk, args);
+
+#ifdef PARALLEL
+    // With the pool busy on another thread's call, this one runs serially
+    if (blk->bucket > 0 && pool_try_acquire()) {
+        do_matrix_parallel(blk, args);
+        pool_release();
+        return;
+    }
+#endif
+    do_matrix(blk, args, get_workspace(blk));
+}
+
+
+static void run_gemm(const gemm_args* args) {
+    blocking blk;
+    make_blocking(&blk, args->M, args->N, args->K);
+    run_blocked(&blk, args);
+}
+
+
+void dgemm(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+           int M, int N, int K, real alpha, const real* A, int lda,
+           const real* B, int ldb, real beta, real* C, int ldc) {
+    static const int ld_pos[3] = { 9, 11, 14 };
+    gemm_args args;
+    if (make_args(&args, __func__, ld_pos, layout, transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc))
+        return;
+    if (trivial(&args))
+        return;
+    run_gemm(&args);
+}
+
+
+#ifndef SINGLE
+void dsgemm(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+            int M, int N, int K, double alpha, const float* A, int lda,
+            const float* B, int ldb, double beta, double* C, int ldc) {
+    static const int ld_pos[3] = { 9, 11, 14 };
+    gemm_args args;
+    if (make_args(&args, __func__, ld_pos, layout, transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc))
+        return;
+    args.format = GEMM_MIXED;
+    if (trivial(&args))
+        return;
+    run_gemm(&args);
+}
+
+
+void zgemm(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+           int M, int N, int K, const void* alpha, const void* A, int lda,
+           const void* B, int ldb, const void* beta, void* C, int ldc) {
+    static const int ld_pos[3] = { 9, 11, 14 };
+    const double* al = (const double*) alpha;
+    const double* be = (const double*) beta;
+    gemm_args args;
+    if (make_args(&args, __func__, ld_pos, layout, transA, transB, M, N, K, al[0], A, lda, B, ldb, be[0], C, ldc))
+        return;
+    args.format = GEMM_COMPLEX;
+    args.alpha_i = al[1];
+    args.beta_i = be[1];
+    // Sizes of the real problem, see pack_A_complex
+    args.N *= 2;
+    args.K *= 2;
+    args.ldc *= 2;
+    if (trivial(&args))
+        return;
+    run_gemm(&args);
+}
+#endif
+
+
+// One batch call: every item shares the shape, scalars and blocking in
+// args / blk, and only the operand pointers change. They come from the
+// pointer arrays if those are set, otherwise from base + i * stride.
+typedef struct {
+    const blocking* blk;
+    const gemm_args* args;
+    int col;
+    const real* const* A_array;
+    const real* const* B_array;
+    real* const* C_array;
+    const real* A;
+    const real* B;
+    real* C;
+    long stride_a, stride_b, stride_c;
+} batch_job;
+
+
+static inline void run_item(const batch_job* job, int i, workspace* ws, int parallel) {
+    gemm_args args = *job->args;
+    const real* A = job->A_array ? job->A_array[i] : job->A + i * job->stride_a;
+    const real* B = job->B_array ? job->B_array[i] : job->B + i * job->stride_b;
+    args.A = job->col ? B : A;
+    args.B = job->col ? A : B;
+    args.C = job->C_array ? job->C_array[i] : job->C + i * job->stride_c;
+
+    if (trivial(&args))
+        return;
+#ifdef PARALLEL
+    if (parallel) {
+        do_matrix_parallel(job->blk, &args);
+        return;
+    }
+#endif
+    (void) parallel;
+    do_matrix(job->blk, &args, ws);
+}
+
+
+#ifdef PARALLEL
+// One task per batch item; each runs serially on its worker's workspace
+static void batch_worker(void* arg, int worker) {
+    batch_job* job = (batch_job*) arg;
+    workspace* ws = get_workspace(job->blk);
+    int t;
+    while ((t = pool_next_task(worker)) >= 0)
+        run_item(job, t, ws, 0);
+}
+#endif
+
+
+// The shape-dependent setup (argument checks, kernel and blocking) is done
+// once for the whole batch. Parallel builds spread the items over the
+// pool, unless there are too few of them to keep every thread busy and
+// each one is large enough to be split on its own. While another thread's
+// call has the pool, the items run serially on this one.
+static void run_batch(batch_job* job, int batch) {
+    blocking blk;
+    make_blocking(&blk, job->args->M, job->args->N, job->args->K);
+    plan_packing(&blk, job->args);
+    job->blk = &blk;
+
+#ifdef PARALLEL
+    if (pool_try_acquire()) {
+        if (batch < pool_num_threads() && blk.bucket > 0) {
+            for (int i = 0; i < batch; ++i)
+                run_item(job, i, NULL, 1);
+        } else {
+            pool_run(batch, batch_worker, job);
+        }
+        pool_release();
+        return;
+    }
+#endif
+    workspace* ws = get_workspace(&blk);
+    for (int i = 0; i < batch; ++i)
+        run_item(job, i, ws, 0);
+}
+
+
+void dgemm_batch(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                 int M, int N, int K, real alpha, const real* const* A, int lda,
+                 const real* const* B, int ldb, real beta, real* const* C, int ldc, int batch) {
+    static const int ld_pos[3] = { 9, 11, 14 };
+    gemm_args args;
+    if (batch < 0) { xerbla(__func__, 15); return; }
+    if (make_args(&args, __func__, ld_pos, layout, transA, transB, M, N, K, alpha, NULL, lda, NULL, ldb, beta, NULL, ldc))
+        return;
+
+    batch_job job;
+    memset(&job, 0, sizeof(job));
+    job.args = &args;
+    job.col = layout == DgemmColMajor;
+    job.A_array = A;
+    job.B_array = B;
+    job.C_array = C;
+    run_batch(&job, batch);
+}
+
+
+void dgemm_batch_strided(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                         int M, int N, int K, real alpha, const real* A, int lda, long stride_a,
+                         const real* B, int ldb, long stride_b, real beta, real* C, int ldc, long stride_c,
+                         int batch) {
+    static const int ld_pos[3] = { 9, 12, 16 };
+    gemm_args args;
+    if (batch < 0) { xerbla(__func__, 18); return; }
+    if (make_args(&args, __func__, ld_pos, layout, transA, transB, M, N, K, alpha, NULL, lda, NULL, ldb, beta, NULL, ldc))
+        return;
+
+    batch_job job;
+    memset(&job, 0, sizeof(job));
+    job.args = &args;
+    job.col = layout == DgemmColMajor;
+    job.A = A;
+    job.B = B;
+    job.C = C;
+    job.stride_a = stride_a;
+    job.stride_b = stride_b;
+    job.stride_c = stride_c;
+    run_batch(&job, batch);
+}
+
+
+// Packs the operand args describes, the A of the row-major problem for
+// side 0 and its B for side 1, into a new handle: every panel the blocked
+// loops would pack, for the current kernel and the bucket of its known
+// dimensions. NULL if out of memory.
+static dgemm_packed* pack_operand(const gemm_args* args, int layout, int operand, int side) {
+    blocking blk;
+    make_blocking(&blk, args->M, args->N, args->K);
+    plan_packing(&blk, args);
+
+    int m = side ? args->N : args->M;
+    int outer = side ? blk.nc : blk.mc;
+    int tile = side ? blk.kernel->nr : blk.kernel->mr;
+    size_t elems = (size_t) ((m + outer - 1) / outer) * args->K * round_up(outer, tile);
+    dgemm_packed* p = (dgemm_packed*) page_alloc(PACKED_HEADER + sizeof(real) * elems);
+    if (!p)
+        return NULL;
+
+    memset(p, 0, PACKED_HEADER);
+    p->magic = PACKED_MAGIC;
+    p->version = PACKED_VERSION;
+    p->header_bytes = PACKED_HEADER;
+    p->alignment = ALIGNMENT;
+    p->elem_size = sizeof(real);
+    p->layout = layout;
+    p->operand = operand;
+    p->side = side;
+    p->m = m;
+    p->k = args->K;
+    p->alpha = args->alpha;
+    dgemm_blocking b = { 0, blk.mc, blk.kc, blk.nc, blk.l1_m, blk.l1_n, blk.l1_k, blk.pf_a, blk.pf_b, blk.pf_c };
+    p->b = b;
+    strncpy(p->kernel_name, blk.kernel->name, sizeof(p->kernel_name) - 1);
+    strncpy(p->isa, blk.kernel->isa, sizeof(p->isa) - 1);
+    p->kernel = blk.kernel;
+    p->elems = elems;
+
+    for (int i = 0; i < m; i += outer) {
+        int cur = min (outer, m - i);
+        for (int k = 0; k < args->K; k += blk.kc) {
+            int curK = min (blk.kc, args->K - k);
+            if (side)
+                pack_B_panel(&blk, args, i, k, cur, curK, packed_panel(p, i, k));
+            else
+                pack_A_panel(&blk, args, i, k, cur, curK, packed_panel(p, i, k));
         }
     }
+    return p;
+}
+
+
+dgemm_packed* dgemm_pack_a(enum dgemm_layout layout, enum dgemm_transpose transA, int M, int K,
+                           real alpha, const real* A, int lda) {
+    static const int ld_pos[3] = { 7, 0, 0 };
+    if (transA != DgemmNoTrans && transA != DgemmTrans && transA != DgemmConjTrans) { xerbla(__func__, 2); return NULL; }
+    if (M < 0) { xerbla(__func__, 3); return NULL; }
+    if (K < 0) { xerbla(__func__, 4); return NULL; }
+
+    // B and C are placeholders, with leading dimensions make_args accepts
+    int ld = M > K ? M : (K > 1 ? K : 1);
+    gemm_args args;
+    if (make_args(&args, __func__, ld_pos, layout, transA, DgemmNoTrans, M, 0, K, alpha, A, lda, NULL, ld, 0.0, NULL, ld))
+        return NULL;
+    return pack_operand(&args, layout, 0, layout == DgemmColMajor);
+}
+
+
+dgemm_packed* dgemm_pack_b(enum dgemm_layout layout, enum dgemm_transpose transB, int K, int N,
+                           real alpha, const real* B, int ldb) {
+    static const int ld_pos[3] = { 0, 7, 0 };
+    if (transB != DgemmNoTrans && transB != DgemmTrans && transB != DgemmConjTrans) { xerbla(__func__, 2); return NULL; }
+    if (K < 0) { xerbla(__func__, 3); return NULL; }
+    if (N < 0) { xerbla(__func__, 4); return NULL; }
+
+    int ld = N > K ? N : (K > 1 ? K : 1);
+    gemm_args args;
+    if (make_args(&args, __func__, ld_pos, layout, DgemmNoTrans, transB, 0, N, K, alpha, NULL, ld, B, ldb, 0.0, NULL, ld))
+        return NULL;
+    return pack_operand(&args, layout, 1, layout != DgemmColMajor);
+}
+
+
+// Whether p is a handle of this element type and version, packed as the
+// given operand under layout
+static int packed_ok(const dgemm_packed* p, enum dgemm_layout layout, int operand) {
+    return p && p->magic == PACKED_MAGIC && p->version == PACKED_VERSION && p->elem_size == (int) sizeof(real)
+        && p->layout == (int) layout && p->operand == operand;
 }
 
 
-void square_dgemm (int lda, double* restrict A, double* restrict B, double* restrict C) {
-    if (lda < 128)
-        do_matrix_small(lda, A, B, C);
+// A leading dimension make_args accepts for the operand p stands in for
+static inline int packed_ld(const dgemm_packed* p) {
+    return p->m > p->k ? p->m : (p->k > 1 ? p->k : 1);
+}
+
+
+// Runs args against the prepacked operand p, with the kernel and block
+// sizes it was packed with; only the parallel split follows the whole
+// problem's bucket.
+static void run_packed(gemm_args* args, const dgemm_packed* p) {
+    if (p->side)
+        args->packed_b = p;
     else
-       do_matrix(lda, A, B, C);
+        args->packed_a = p;
+    if (trivial(args))
+        return;
+
+    pthread_once(&tuning_once, load_tuning);
+    blocking blk;
+    init_blocking(&blk, p->kernel, find_bucket(args->M, args->N, args->K), &p->b);
+    run_blocked(&blk, args);
+}
+
+
+void dgemm_compute_packed(enum dgemm_layout layout, enum dgemm_transpose transA, int M, const real* A, int lda,
+                          const dgemm_packed* B, real beta, real* C, int ldc) {
+    static const int ld_pos[3] = { 5, 0, 9 };
+    if (!packed_ok(B, layout, 1)) { xerbla(__func__, 6); return; }
+    if (M < 0) { xerbla(__func__, 3); return; }
+
+    gemm_args args;
+    if (make_args(&args, __func__, ld_pos, layout, transA, DgemmNoTrans, M, B->m, B->k, B->alpha, A, lda,
+                  NULL, packed_ld(B), beta, C, ldc))
+        return;
+    run_packed(&args, B);
 }
 
+
+void dgemm_compute_packed_a(enum dgemm_layout layout, const dgemm_packed* A, enum dgemm_transpose transB, int N,
+                            const real* B, int ldb, real beta, real* C, int ldc) {
+    static const int ld_pos[3] = { 0, 6, 9 };
+    if (!packed_ok(A, layout, 0)) { xerbla(__func__, 2); return; }
+    if (N < 0) { xerbla(__func__, 4); return; }
+
+    gemm_args args;
+    if (make_args(&args, __func__, ld_pos, layout, DgemmNoTrans, transB, A->m, N, A->k, A->alpha, NULL, packed_ld(A),
+                  B, ldb, beta, C, ldc))
+        return;
+    run_packed(&args, A);
+}
+
+
+void dgemm_packed_free(dgemm_packed* p) {
+    if (p && p->map_bytes)
+        munmap(p, p->map_bytes);
+    else
+        page_free(p);
+}
+
+
+int dgemm_packed_save(const dgemm_packed* p, const char* path) {
+    if (!p || !packed_ok(p, p->layout, p->operand))
+        return -1;
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return -1;
+
+    // The pointer and the mapping only mean something in this process
+    char header[PACKED_HEADER];
+    memcpy(header, p, PACKED_HEADER);
+    ((dgemm_packed*) header)->kernel = NULL;
+    ((dgemm_packed*) header)->map_bytes = 0;
+    int ok = fwrite(header, 1, PACKED_HEADER, f) == PACKED_HEADER
+        && fwrite(packed_data(p), sizeof(real), p->elems, f) == p->elems;
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+
+// Whether the header of a mapped file of size bytes describes a handle
+// this build would have packed: same format, a size that matches its
+// dimensions and block sizes, and the kernel in use now.
+static int packed_file_ok(const dgemm_packed* p, size_t size) {
+    if (size < PACKED_HEADER || p->magic != PACKED_MAGIC || p->version != PACKED_VERSION
+        || p->header_bytes != PACKED_HEADER || p->alignment != ALIGNMENT || p->elem_size != (int) sizeof(real))
+        return 0;
+    if ((p->layout != DgemmRowMajor && p->layout != DgemmColMajor) || (p->operand & ~1) || (p->side & ~1)
+        || p->m < 0 || p->k < 0 || !valid_blocking(&p->b)
+        || (size - PACKED_HEADER) % sizeof(real) != 0 || p->elems != (size - PACKED_HEADER) / sizeof(real))
+        return 0;
+    if (strncmp(p->kernel_name, dgemm_kernel_name(), sizeof(p->kernel_name)) != 0)
+        return 0;
+
+    const micro_kernel* kernel = select_kernel();
+    int outer = p->side ? p->b.nc : p->b.mc;
+    int tile = p->side ? kernel->nr : kernel->mr;
+    return p->elems == ((size_t) p->m + outer - 1) / outer * p->k * round_up(outer, tile);
+}
+
+
+dgemm_packed* dgemm_packed_map(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < PACKED_HEADER) {
+        close(fd);
+        return NULL;
+    }
+
+    // Private and writable, so only the header page is copied when kernel
+    // and map_bytes are set; the panels stay the page cache's, faulted in
+    // as the kernels first read them
+    size_t size = st.st_size;
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    dgemm_packed* p = (dgemm_packed*) base;
+    if (!packed_file_ok(p, size)) {
+        munmap(base, size);
+        return NULL;
+    }
+    p->kernel = select_kernel();
+    p->map_bytes = size;
+    return p;
+}
+
+
+int dgemm_set_strassen_cutoff(int cutoff) {
+    pthread_once(&tuning_once, load_tuning);
+    return set_cutoff(cutoff);
+}
+
+
+// X := P + s * Q, for h x h blocks; X may be P, so neither is restrict
+static void add_block(int h, real* X, int ldx, const real* P, int ldp, real s, const real* Q, int ldq) {
+    for (int i = 0; i < h; ++i)
+        for (int j = 0; j < h; ++j)
+            X[i * ldx + j] = P[i * ldp + j] + s * Q[i * ldq + j];
+}
+
+
+// X := beta * X + P, with beta 0 or 1; beta == 0 never reads X
+static void acc_block(int h, real beta, real* restrict X, int ldx, const real* restrict P, int ldp) {
+    if (beta == 0.0)
+        copy_block(h, h, X, ldx, (real*) P, ldp);
+    else
+        add_block(h, X, ldx, X, ldx, 1.0, P, ldp);
+}
+
+
+// Scratch strassen needs for an n x n problem: three h x h temporaries
+// per level of recursion
+static size_t strassen_scratch(int n, int cutoff) {
+    size_t size = 0;
+    for (; n > cutoff; n /= 2)
+        size += 3 * (size_t) (n / 2) * skew_ld(n / 2);
+    return size;
+}
+
+
+// C := A * B + beta * C (beta 0 or 1) for row-major n x n matrices,
+// by Winograd's variant of Strassen: seven half-size products, each
+// computed the same way down to cutoff, where dgemm takes over. With
+// h = n / 2 and the S / T sums of the operands' quarters,
+//   P1 = A11 B11   P2 = A12 B21   P3 = S4 B22   P4 = A22 T4
+//   P5 = S1 T1     P6 = S2 T2     P7 = S3 T3
+//   C11 = P1 + P2            C12 = P1 + P6 + P5 + P3
+//   C21 = P1 + P6 + P7 - P4  C22 = P1 + P6 + P7 + P5
+// P1 + P6 is formed once and the other products are accumulated straight
+// into C where they appear once, so a level needs only X, Y (operand
+// sums) and Z (a product) from scratch. An odd n leaves a last row and
+// column, done by dgemm along with the rank-1 update of the rest.
+static void strassen(int n, const real* A, int lda, const real* B, int ldb,
+                     real beta, real* C, int ldc, real* scratch, int cutoff) {
+    if (n <= cutoff) {
+        dgemm(DgemmRowMajor, DgemmNoTrans, DgemmNoTrans, n, n, n, 1.0, A, lda, B, ldb, beta, C, ldc);
+        return;
+    }
+
+    int h = n / 2;
+    int ld = skew_ld(h);
+    real* X = scratch;
+    real* Y = X + (size_t) h * ld;
+    real* Z = Y + (size_t) h * ld;
+    real* next = Z + (size_t) h * ld;
+    const real *A11 = A, *A12 = A + h, *A21 = A + h * lda, *A22 = A21 + h;
+    const real *B11 = B, *B12 = B + h, *B21 = B + h * ldb, *B22 = B21 + h;
+    real *C11 = C, *C12 = C + h, *C21 = C + h * ldc, *C22 = C21 + h;
+
+    // C11 = P1 + P2
+    strassen(h, A11, lda, B11, ldb, 0.0, Z, ld, next, cutoff);
+    acc_block(h, beta, C11, ldc, Z, ld);
+    strassen(h, A12, lda, B21, ldb, 1.0, C11, ldc, next, cutoff);
+
+    // Z = P1 + P6, with S2 = A21 + A22 - A11 and T2 = B22 - B12 + B11
+    add_block(h, X, ld, A21, lda, 1.0, A22, lda);
+    add_block(h, X, ld, X, ld, -1.0, A11, lda);
+    add_block(h, Y, ld, B22, ldb, -1.0, B12, ldb);
+    add_block(h, Y, ld, Y, ld, 1.0, B11, ldb);
+    strassen(h, X, ld, Y, ld, 1.0, Z, ld, next, cutoff);
+    acc_block(h, beta, C12, ldc, Z, ld);
+    acc_block(h, beta, C21, ldc, Z, ld);
+    acc_block(h, beta, C22, ldc, Z, ld);
+
+    // P7, with S3 = A11 - A21 and T3 = B22 - B12
+    add_block(h, X, ld, A11, lda, -1.0, A21, lda);
+    add_block(h, Y, ld, B22, ldb, -1.0, B12, ldb);
+    strassen(h, X, ld, Y, ld, 0.0, Z, ld, next, cutoff);
+    acc_block(h, 1.0, C21, ldc, Z, ld);
+    acc_block(h, 1.0, C22, ldc, Z, ld);
+
+    // P5, with S1 = A21 + A22 and T1 = B12 - B11
+    add_block(h, X, ld, A21, lda, 1.0, A22, lda);
+    add_block(h, Y, ld, B12, ldb, -1.0, B11, ldb);
+    strassen(h, X, ld, Y, ld, 0.0, Z, ld, next, cutoff);
+    acc_block(h, 1.0, C12, ldc, Z, ld);
+    acc_block(h, 1.0, C22, ldc, Z, ld);
+
+    // P3, with S4 = A12 - S2 = A12 + A11 - A21 - A22
+    add_block(h, X, ld, A12, lda, 1.0, A11, lda);
+    add_block(h, X, ld, X, ld, -1.0, A21, lda);
+    add_block(h, X, ld, X, ld, -1.0, A22, lda);
+    strassen(h, X, ld, B22, ldb, 1.0, C12, ldc, next, cutoff);
+
+    // -P4, with -T4 = B21 - T2 = B21 - B22 + B12 - B11
+    add_block(h, Y, ld, B21, ldb, -1.0, B22, ldb);
+    add_block(h, Y, ld, Y, ld, 1.0, B12, ldb);
+    add_block(h, Y, ld, Y, ld, -1.0, B11, ldb);
+    strassen(h, A22, lda, Y, ld, 1.0, C21, ldc, next, cutoff);
+
+    if (n > 2 * h) {
+        int m = 2 * h;
+        dgemm(DgemmRowMajor, DgemmNoTrans, DgemmNoTrans, m, m, 1, 1.0, A + m, lda, B + m * ldb, ldb, 1.0, C, ldc);
+        dgemm(DgemmRowMajor, DgemmNoTrans, DgemmNoTrans, m, 1, n, 1.0, A, lda, B + m, ldb, beta, C + m, ldc);
+        dgemm(DgemmRowMajor, DgemmNoTrans, DgemmNoTrans, 1, n, n, 1.0, A + m * lda, lda, B, ldb, beta, C + m * ldc, ldc);
+    }
+}
+
+
+void square_dgemm (int lda, real* restrict A, real* restrict B, real* restrict C) {
+    pthread_once(&tuning_once, load_tuning);
+    int cutoff = strassen_cutoff;
+    if (cutoff > 0 && lda > cutoff) {
+        // The scratch is reserved up front, so the recursion doesn't allocate
+        workspace* ws = thread_workspace();
+        reserve(&ws->scratch, &ws->scratch_size, strassen_scratch(lda, cutoff));
+        strassen(lda, A, lda, B, lda, 1.0, C, lda, ws->scratch, cutoff);
+        return;
+    }
+    dgemm(DgemmRowMajor, DgemmNoTrans, DgemmNoTrans, lda, lda, lda,
+          1.0, A, lda, B, lda, 1.0, C, lda);
+}
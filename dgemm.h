@@ -0,0 +1,204 @@
+#ifndef _DGEMM_H
+#define _DGEMM_H
+
+#include <stddef.h>
+
+/*
+ * General matrix multiply
+ *   C := alpha * op(A) * op(B) + beta * C
+ * where op(A) is M x K, op(B) is K x N and C is M x N, following the
+ * CBLAS conventions. The enum values match CBLAS_LAYOUT and
+ * CBLAS_TRANSPOSE, so those can be passed straight through.
+ */
+
+enum dgemm_layout { DgemmRowMajor = 101, DgemmColMajor = 102 };
+enum dgemm_transpose { DgemmNoTrans = 111, DgemmTrans = 112, DgemmConjTrans = 113 };
+
+void dgemm(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+           int M, int N, int K, double alpha, const double* A, int lda,
+           const double* B, int ldb, double beta, double* C, int ldc);
+
+/*
+ * Any number of threads may multiply at once, each into its own C. The
+ * parallel build has one worker pool, used by one call at a time: a call
+ * made while another thread's has it runs on the calling thread alone.
+ */
+
+/*
+ * batch independent problems C[i] := alpha * op(A[i]) * op(B[i]) + beta * C[i]
+ * sharing one shape. Issue one call per shape group: the setup is done
+ * once per call, and parallel builds run the items across threads.
+ */
+void dgemm_batch(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                 int M, int N, int K, double alpha, const double* const* A, int lda,
+                 const double* const* B, int ldb, double beta, double* const* C, int ldc, int batch);
+
+/* As dgemm_batch, with item i at A + i * stride_a, B + i * stride_b, C + i * stride_c */
+void dgemm_batch_strided(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                         int M, int N, int K, double alpha, const double* A, int lda, long stride_a,
+                         const double* B, int ldb, long stride_b, double beta, double* C, int ldc, long stride_c,
+                         int batch);
+
+/*
+ * Prepacked operands, for a matrix multiplied against many others (model
+ * weights, say). dgemm_pack_b packs alpha * op(B), K x N, once into the
+ * kernels' layout and dgemm_compute_packed then computes
+ *   C := alpha * op(A) * op(B) + beta * C
+ * for any M and A without repacking it; dgemm_pack_a and
+ * dgemm_compute_packed_a do the same with op(A), M x K, fixed. A handle
+ * keeps the kernel and block sizes it was packed with, so later tuning
+ * changes don't invalidate it, and it only works with the layout it was
+ * packed under. Handles are opaque and versioned, and read-only once made:
+ * any number of threads can compute with one, the parallel build's pool
+ * going to one call at a time as for dgemm. The pack functions return
+ * NULL if an argument is illegal or memory runs out; compute calls given a
+ * NULL, foreign or mismatched handle report it like an illegal argument.
+ */
+typedef struct dgemm_packed dgemm_packed;
+
+dgemm_packed* dgemm_pack_a(enum dgemm_layout layout, enum dgemm_transpose transA, int M, int K,
+                           double alpha, const double* A, int lda);
+dgemm_packed* dgemm_pack_b(enum dgemm_layout layout, enum dgemm_transpose transB, int K, int N,
+                           double alpha, const double* B, int ldb);
+void dgemm_compute_packed(enum dgemm_layout layout, enum dgemm_transpose transA, int M, const double* A, int lda,
+                          const dgemm_packed* B, double beta, double* C, int ldc);
+void dgemm_compute_packed_a(enum dgemm_layout layout, const dgemm_packed* A, enum dgemm_transpose transB, int N,
+                            const double* B, int ldb, double beta, double* C, int ldc);
+void dgemm_packed_free(dgemm_packed* p);
+
+/*
+ * Handles on disk, for operands too large to repack at every start:
+ * dgemm_packed_save writes one to path (returns -1 on failure), and
+ * dgemm_packed_map maps such a file back without copying, so its panels
+ * are read in by page faults as they are first used. The file holds the
+ * panels after a header with the format version, element size, kernel
+ * (name and ISA), alignment and block sizes. dgemm_packed_map returns NULL
+ * if the file can't be read or doesn't match this build and the kernel in
+ * use: then pack the operand again and save the new handle. Free a
+ * mapped handle with dgemm_packed_free too.
+ */
+int dgemm_packed_save(const dgemm_packed* p, const char* path);
+dgemm_packed* dgemm_packed_map(const char* path);
+
+/*
+ * Block sizes, chosen at run time per problem-size bucket: a problem goes
+ * to the first bucket whose max_dim is larger than its largest dimension
+ * (the last bucket has max_dim 0 and takes the rest). Defaults are built
+ * in. At the first call they are overridden from the file named by
+ * DGEMM_TUNING, or dgemm-tuning.txt, if autotune has written one for the
+ * kernel in use. DGEMM_PREFETCH=<pf_a>,<pf_b>,<pf_c> then overrides the
+ * prefetch distances of every bucket. Setting them while other threads are
+ * inside dgemm is not supported.
+ */
+#define DGEMM_BUCKETS 3
+
+typedef struct {
+    int max_dim;       /* bucket bound, fixed; ignored by dgemm_set_blocking */
+    int mc;            /* rows of A packed per step against a B panel */
+    int kc;            /* K extent of the packed A slab and B panel */
+    int nc;            /* columns of B per packed panel */
+    int l1_m, l1_n, l1_k;
+    int pf_a, pf_b;    /* K steps the kernel prefetches its A / B slivers ahead (and B rows ahead while packing); 0 is off */
+    int pf_c;          /* register tiles of C prefetched ahead of the kernel; 0 is off */
+} dgemm_blocking;
+
+int dgemm_get_blocking(int bucket, dgemm_blocking* b);
+/* Returns -1 if bucket or any size is out of range */
+int dgemm_set_blocking(int bucket, const dgemm_blocking* b);
+/* Returns the number of buckets loaded, or -1 if path can't be read */
+int dgemm_load_tuning(const char* path);
+int dgemm_save_tuning(const char* path);
+/* Name of the micro-kernel in use, which tuning files are keyed by */
+const char* dgemm_kernel_name(void);
+/*
+ * The register-tile kernels this CPU can run, e.g. avx512_8x24: the i-th,
+ * or NULL past the last. dgemm_set_kernel switches to one (or to an ISA's
+ * default tile, e.g. avx2), resets the block sizes for it and loads its
+ * tuning lines; dgemm_save_tuning then records it as the kernel to use.
+ * Returns -1 if there is no such kernel here.
+ */
+const char* dgemm_kernel_at(int i);
+int dgemm_set_kernel(const char* name);
+
+/* C := C + A * B for n x n row-major matrices */
+void square_dgemm(int n, double* A, double* B, double* C);
+
+/*
+ * Strassen-Winograd for square_dgemm: above cutoff it recurses on seven
+ * half-size products instead of eight, down to sizes of cutoff or less,
+ * which the blocked code does. It trades accuracy for it: the error is
+ * bounded normwise, growing as about 18^levels * eps * max|A| * max|B|,
+ * rather than componentwise. 0, the default, turns it off; the first call
+ * takes it from DGEMM_STRASSEN if that is set. Returns -1 for a cutoff
+ * below 64. dgemm itself never uses it.
+ */
+int dgemm_set_strassen_cutoff(int cutoff);
+
+/*
+ * Pages behind the packing buffers and dgemm_malloc's blocks: small
+ * (the default), transparent huge pages, or explicit huge pages from the
+ * pool reserved through vm.nr_hugepages, falling back to transparent ones
+ * when it is empty. Huge pages keep the packed panels and large matrices
+ * within a few TLB entries. The first allocation takes the mode from
+ * DGEMM_PAGES=thp|huge if set. Buffers already allocated keep their pages.
+ * Returns -1 for an unknown mode.
+ */
+enum dgemm_pages { DgemmPagesSmall = 0, DgemmPagesTransparent = 1, DgemmPagesHuge = 2 };
+int dgemm_set_pages(enum dgemm_pages pages);
+
+/* 64-byte aligned memory on those pages, for matrices; NULL if out of memory */
+void* dgemm_malloc(size_t bytes);
+void dgemm_free(void* p);
+
+/*
+ * The other element types, with the same blocking and packing. sgemm is
+ * the single precision build of everything above, with its own kernels
+ * and tuning (SGEMM_TUNING, or sgemm-tuning.txt, and SGEMM_STRASSEN).
+ */
+void sgemm(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+           int M, int N, int K, float alpha, const float* A, int lda,
+           const float* B, int ldb, float beta, float* C, int ldc);
+void sgemm_batch(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                 int M, int N, int K, float alpha, const float* const* A, int lda,
+                 const float* const* B, int ldb, float beta, float* const* C, int ldc, int batch);
+void sgemm_batch_strided(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+                         int M, int N, int K, float alpha, const float* A, int lda, long stride_a,
+                         const float* B, int ldb, long stride_b, float beta, float* C, int ldc, long stride_c,
+                         int batch);
+int sgemm_get_blocking(int bucket, dgemm_blocking* b);
+int sgemm_set_blocking(int bucket, const dgemm_blocking* b);
+int sgemm_load_tuning(const char* path);
+int sgemm_save_tuning(const char* path);
+const char* sgemm_kernel_name(void);
+const char* sgemm_kernel_at(int i);
+int sgemm_set_kernel(const char* name);
+void square_sgemm(int n, float* A, float* B, float* C);
+typedef struct sgemm_packed sgemm_packed;
+sgemm_packed* sgemm_pack_a(enum dgemm_layout layout, enum dgemm_transpose transA, int M, int K,
+                           float alpha, const float* A, int lda);
+sgemm_packed* sgemm_pack_b(enum dgemm_layout layout, enum dgemm_transpose transB, int K, int N,
+                           float alpha, const float* B, int ldb);
+void sgemm_compute_packed(enum dgemm_layout layout, enum dgemm_transpose transA, int M, const float* A, int lda,
+                          const sgemm_packed* B, float beta, float* C, int ldc);
+void sgemm_compute_packed_a(enum dgemm_layout layout, const sgemm_packed* A, enum dgemm_transpose transB, int N,
+                            const float* B, int ldb, float beta, float* C, int ldc);
+void sgemm_packed_free(sgemm_packed* p);
+int sgemm_packed_save(const sgemm_packed* p, const char* path);
+sgemm_packed* sgemm_packed_map(const char* path);
+int sgemm_set_strassen_cutoff(int cutoff);
+
+/* float A and B, multiplied and accumulated in double into a double C */
+void dsgemm(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+            int M, int N, int K, double alpha, const float* A, int lda,
+            const float* B, int ldb, double beta, double* C, int ldc);
+
+/*
+ * Complex double, as cblas_zgemm: A, B, C and the scalars point to
+ * interleaved (re, im) pairs, leading dimensions count complex elements,
+ * and DgemmConjTrans conjugates.
+ */
+void zgemm(enum dgemm_layout layout, enum dgemm_transpose transA, enum dgemm_transpose transB,
+           int M, int N, int K, const void* alpha, const void* A, int lda,
+           const void* B, int ldb, const void* beta, void* C, int ldc);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ *  Huge-page backed allocation for the packing workspace and matrices.
+ *
+ *  Every block starts with a one-line header recording how it was
+ *  obtained, so page_free needs no size and blocks outlive mode changes.
+ *  Huge-page blocks are whole 2 MB pages, 2 MB aligned: transparent ones
+ *  are madvise'd (the usual "enabled = madvise" setting needs that), and
+ *  explicit ones come from mmap(MAP_HUGETLB), which fails unless
+ *  vm.nr_hugepages has reserved some.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "dgemm.h"
+#include "huge-pages.h"
+
+#define HEADER 64
+#define HUGE_PAGE (2UL << 20)
+
+enum { FROM_MALLOC, FROM_MMAP };
+
+typedef struct {
+    size_t total;   // bytes from the start of the block, header included
+    int from;
+} block_header;
+
+static enum dgemm_pages page_mode = DgemmPagesSmall;
+static pthread_once_t mode_once = PTHREAD_ONCE_INIT;
+
+
+static void load_mode(void) {
+    const char* env = getenv("DGEMM_PAGES");
+    if (!env)
+        return;
+    if (strcmp(env, "thp") == 0)
+        page_mode = DgemmPagesTransparent;
+    else if (strcmp(env, "huge") == 0)
+        page_mode = DgemmPagesHuge;
+}
+
+
+int dgemm_set_pages(enum dgemm_pages pages) {
+    pthread_once(&mode_once, load_mode);
+    if (pages != DgemmPagesSmall && pages != DgemmPagesTransparent && pages != DgemmPagesHuge)
+        return -1;
+    page_mode = pages;
+    return 0;
+}
+
+
+static void* with_header(void* base, size_t total, int from) {
+    block_header* h = (block_header*) base;
+    h->total = total;
+    h->from = from;
+    return (char*) base + HEADER;
+}
+
+
+void* page_alloc(size_t bytes) {
+    pthread_once(&mode_once, load_mode);
+    enum dgemm_pages mode = page_mode;
+    void* base = NULL;
+
+    if (mode == DgemmPagesHuge) {
+        size_t total = (bytes + HEADER + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED)
+            return with_header(base, total, FROM_MMAP);
+        mode = DgemmPagesTransparent;
+    }
+
+    if (mode == DgemmPagesTransparent) {
+        size_t total = (bytes + HEADER + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        if (posix_memalign(&base, HUGE_PAGE, total) != 0)
+            return NULL;
+        madvise(base, total, MADV_HUGEPAGE);
+        return with_header(base, total, FROM_MALLOC);
+    }
+
+    if (posix_memalign(&base, HEADER, bytes + HEADER) != 0)
+        return NULL;
+    return with_header(base, bytes + HEADER, FROM_MALLOC);
+}
+
+
+void page_free(void* p) {
+    if (!p)
+        return;
+    block_header* h = (block_header*) ((char*) p - HEADER);
+    if (h->from == FROM_MMAP)
+        munmap(h, h->total);
+    else
+        free(h);
+}
+
+
+void* dgemm_malloc(size_t bytes) {
+    return page_alloc(bytes);
+}
+
+
+void dgemm_free(void* p) {
+    page_free(p);
+}
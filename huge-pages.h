@@ -0,0 +1,17 @@
+#ifndef _HUGE_PAGES_H
+#define _HUGE_PAGES_H
+
+#include <stddef.h>
+
+/*
+ * Allocator for the packing buffers and, through dgemm_malloc, the
+ * caller's matrices: small pages, transparent huge pages, or explicit
+ * (hugetlbfs) huge pages falling back to transparent ones when none are
+ * reserved. The mode is process-wide, see dgemm_set_pages in dgemm.h.
+ */
+
+// 64-byte aligned, NULL when out of memory. page_free takes NULL.
+void* page_alloc(size_t bytes);
+void page_free(void* p);
+
+#endif
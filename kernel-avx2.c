@@ -0,0 +1,104 @@
+/*
+ *  AVX2 + FMA micro-kernels, built with -mavx2 -mfma.
+ *
+ *  16 ymm registers: 12 accumulators plus the B row or the A broadcasts,
+ *  whichever is fewer. The default 3 x 16 double tile is the original
+ *  avx_kernel (3 rows of 4 __m256d, 3 broadcasts, 1 B vector).
+ */
+
+#include <immintrin.h>
+#include "kernel.h"
+
+#define KT_KERNEL micro_kernel
+#define KT_PREFIX kernel_
+#define KT_ISA "avx2"
+#define KT_T double
+#define KT_V __m256d
+#define KT_LANES 4
+#define KT_MASK __m256i
+#define KT_MASK_FOR(n) _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_setr_epi64x(0, 1, 2, 3))
+#define KT_LOAD(p) _mm256_load_pd(p)
+#define KT_LOADU(p) _mm256_loadu_pd(p)
+#define KT_MLOAD(p, k) _mm256_maskload_pd(p, k)
+#define KT_STOREU(p, v) _mm256_storeu_pd(p, v)
+#define KT_MSTORE(p, k, v) _mm256_maskstore_pd(p, k, v)
+#define KT_BCAST(p) _mm256_broadcast_sd(p)
+#define KT_SET1(x) _mm256_set1_pd(x)
+#define KT_ZERO() _mm256_setzero_pd()
+#define KT_FMA(a, b, c) _mm256_fmadd_pd(a, b, c)
+
+#define KT_NAME avx2_3x16
+#define KT_MR 3
+#define KT_NV 4
+#include "kernel-template.h"
+
+#define KT_NAME avx2_4x12
+#define KT_MR 4
+#define KT_NV 3
+#include "kernel-template.h"
+
+#define KT_NAME avx2_6x8
+#define KT_MR 6
+#define KT_NV 2
+#include "kernel-template.h"
+
+#define KT_NAME avx2_2x24
+#define KT_MR 2
+#define KT_NV 6
+#include "kernel-template.h"
+
+#undef KT_KERNEL
+#undef KT_PREFIX
+#undef KT_T
+#undef KT_V
+#undef KT_LANES
+#undef KT_MASK
+#undef KT_MASK_FOR
+#undef KT_LOAD
+#undef KT_LOADU
+#undef KT_MLOAD
+#undef KT_STOREU
+#undef KT_MSTORE
+#undef KT_BCAST
+#undef KT_SET1
+#undef KT_ZERO
+#undef KT_FMA
+
+
+// Single precision: 8-wide __m256
+#define KT_KERNEL smicro_kernel
+#define KT_PREFIX skernel_
+#define KT_T float
+#define KT_V __m256
+#define KT_LANES 8
+#define KT_MASK __m256i
+#define KT_MASK_FOR(n) _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))
+#define KT_LOAD(p) _mm256_load_ps(p)
+#define KT_LOADU(p) _mm256_loadu_ps(p)
+#define KT_MLOAD(p, k) _mm256_maskload_ps(p, k)
+#define KT_STOREU(p, v) _mm256_storeu_ps(p, v)
+#define KT_MSTORE(p, k, v) _mm256_maskstore_ps(p, k, v)
+#define KT_BCAST(p) _mm256_broadcast_ss(p)
+#define KT_SET1(x) _mm256_set1_ps(x)
+#define KT_ZERO() _mm256_setzero_ps()
+#define KT_FMA(a, b, c) _mm256_fmadd_ps(a, b, c)
+
+#define KT_NAME avx2_6x16
+#define KT_MR 6
+#define KT_NV 2
+#include "kernel-template.h"
+
+#define KT_NAME avx2_4x24
+#define KT_MR 4
+#define KT_NV 3
+#include "kernel-template.h"
+
+#define KT_NAME avx2_3x32
+#define KT_MR 3
+#define KT_NV 4
+#include "kernel-template.h"
+
+#define KT_NAME avx2_12x8
+#define KT_MR 12
+#define KT_NV 1
+#include "kernel-template.h"
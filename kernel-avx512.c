@@ -0,0 +1,115 @@
+/*
+ *  AVX-512 micro-kernels, built with -mavx512f.
+ *
+ *  32 zmm registers: the default 8 x 24 double tile holds 8 rows of 3
+ *  __m512d accumulators (24 zmm), plus 3 zmm for the B row and 1 for the
+ *  broadcast A element. The other shapes trade rows for columns at about
+ *  the same register count.
+ */
+
+#include <immintrin.h>
+#include "kernel.h"
+
+#define KT_KERNEL micro_kernel
+#define KT_PREFIX kernel_
+#define KT_ISA "avx512"
+#define KT_T double
+#define KT_V __m512d
+#define KT_LANES 8
+#define KT_MASK __mmask8
+#define KT_MASK_FOR(n) ((__mmask8) (0xFF >> (8 - (n))))
+#define KT_LOAD(p) _mm512_load_pd(p)
+#define KT_LOADU(p) _mm512_loadu_pd(p)
+#define KT_MLOAD(p, k) _mm512_maskz_loadu_pd(k, p)
+#define KT_STOREU(p, v) _mm512_storeu_pd(p, v)
+#define KT_MSTORE(p, k, v) _mm512_mask_storeu_pd(p, k, v)
+#define KT_BCAST(p) _mm512_set1_pd(*(p))
+#define KT_SET1(x) _mm512_set1_pd(x)
+#define KT_ZERO() _mm512_setzero_pd()
+#define KT_FMA(a, b, c) _mm512_fmadd_pd(a, b, c)
+
+#define KT_NAME avx512_8x24
+#define KT_MR 8
+#define KT_NV 3
+#include "kernel-template.h"
+
+#define KT_NAME avx512_12x16
+#define KT_MR 12
+#define KT_NV 2
+#include "kernel-template.h"
+
+#define KT_NAME avx512_14x16
+#define KT_MR 14
+#define KT_NV 2
+#include "kernel-template.h"
+
+#define KT_NAME avx512_6x32
+#define KT_MR 6
+#define KT_NV 4
+#include "kernel-template.h"
+
+#define KT_NAME avx512_4x48
+#define KT_MR 4
+#define KT_NV 6
+#include "kernel-template.h"
+
+#define KT_NAME avx512_24x8
+#define KT_MR 24
+#define KT_NV 1
+#include "kernel-template.h"
+
+#undef KT_KERNEL
+#undef KT_PREFIX
+#undef KT_T
+#undef KT_V
+#undef KT_LANES
+#undef KT_MASK
+#undef KT_MASK_FOR
+#undef KT_LOAD
+#undef KT_LOADU
+#undef KT_MLOAD
+#undef KT_STOREU
+#undef KT_MSTORE
+#undef KT_BCAST
+#undef KT_SET1
+#undef KT_ZERO
+#undef KT_FMA
+
+
+// Single precision: the same tiles on __m512, twice as wide
+#define KT_KERNEL smicro_kernel
+#define KT_PREFIX skernel_
+#define KT_T float
+#define KT_V __m512
+#define KT_LANES 16
+#define KT_MASK __mmask16
+#define KT_MASK_FOR(n) ((__mmask16) (0xFFFF >> (16 - (n))))
+#define KT_LOAD(p) _mm512_load_ps(p)
+#define KT_LOADU(p) _mm512_loadu_ps(p)
+#define KT_MLOAD(p, k) _mm512_maskz_loadu_ps(k, p)
+#define KT_STOREU(p, v) _mm512_storeu_ps(p, v)
+#define KT_MSTORE(p, k, v) _mm512_mask_storeu_ps(p, k, v)
+#define KT_BCAST(p) _mm512_set1_ps(*(p))
+#define KT_SET1(x) _mm512_set1_ps(x)
+#define KT_ZERO() _mm512_setzero_ps()
+#define KT_FMA(a, b, c) _mm512_fmadd_ps(a, b, c)
+
+#define KT_NAME avx512_8x48
+#define KT_MR 8
+#define KT_NV 3
+#include "kernel-template.h"
+
+#define KT_NAME avx512_12x32
+#define KT_MR 12
+#define KT_NV 2
+#include "kernel-template.h"
+
+#define KT_NAME avx512_6x64
+#define KT_MR 6
+#define KT_NV 4
+#include "kernel-template.h"
+
+#define KT_NAME avx512_24x16
+#define KT_MR 24
+#define KT_NV 1
+#include "kernel-template.h"
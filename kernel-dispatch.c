@@ -0,0 +1,100 @@
+/*
+ *  Runtime micro-kernel selection. __builtin_cpu_supports reads CPUID
+ *  (and checks that the OS saves the wider register state), so one
+ *  binary runs the widest kernel the host can execute.
+ *
+ *  The tables list every tile kernel-template.h was instantiated for;
+ *  the first one of each ISA is its default, the shape that ISA had
+ *  before the tiles were generated. autotune -k measures the others.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "kernel.h"
+
+extern const micro_kernel kernel_avx512_8x24, kernel_avx512_12x16, kernel_avx512_14x16, kernel_avx512_6x32,
+    kernel_avx512_4x48, kernel_avx512_24x8;
+extern const micro_kernel kernel_avx2_3x16, kernel_avx2_4x12, kernel_avx2_6x8, kernel_avx2_2x24;
+extern const micro_kernel kernel_scalar_4x4;
+
+extern const smicro_kernel skernel_avx512_8x48, skernel_avx512_12x32, skernel_avx512_6x64, skernel_avx512_24x16;
+extern const smicro_kernel skernel_avx2_6x16, skernel_avx2_4x24, skernel_avx2_3x32, skernel_avx2_12x8;
+extern const smicro_kernel skernel_scalar_4x4;
+
+const micro_kernel* const dgemm_kernels[] = {
+    &kernel_avx512_8x24, &kernel_avx512_12x16, &kernel_avx512_14x16, &kernel_avx512_6x32,
+    &kernel_avx512_4x48, &kernel_avx512_24x8,
+    &kernel_avx2_3x16, &kernel_avx2_4x12, &kernel_avx2_6x8, &kernel_avx2_2x24,
+    &kernel_scalar_4x4,
+    NULL
+};
+
+const smicro_kernel* const sgemm_kernels[] = {
+    &skernel_avx512_8x48, &skernel_avx512_12x32, &skernel_avx512_6x64, &skernel_avx512_24x16,
+    &skernel_avx2_6x16, &skernel_avx2_4x24, &skernel_avx2_3x32, &skernel_avx2_12x8,
+    &skernel_scalar_4x4,
+    NULL
+};
+
+static const micro_kernel* selected = NULL;
+static const smicro_kernel* sselected = NULL;
+
+
+static int supported(const char* isa) {
+    __builtin_cpu_init();
+    if (strcmp(isa, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f");
+    if (strcmp(isa, "avx2") == 0)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return 1;
+}
+
+
+// The same lookup on both tables: they only differ in the element type,
+// and name / isa come first in both structs.
+#define FIND(table, name)                                                            \
+    for (int i = 0; (name) && table[i]; ++i)                                         \
+        if ((strcmp(name, table[i]->name) == 0 || strcmp(name, table[i]->isa) == 0)  \
+            && supported(table[i]->isa))                                             \
+            return table[i];                                                         \
+    return NULL;
+
+
+const micro_kernel* find_kernel(const char* name) {
+    FIND(dgemm_kernels, name)
+}
+
+
+const smicro_kernel* find_skernel(const char* name) {
+    FIND(sgemm_kernels, name)
+}
+
+
+// DGEMM_KERNEL names a tile or an ISA; an ISA name picks the same ISA for
+// both tables, a tile name only the table it is in.
+const micro_kernel* select_kernel(void) {
+    if (!selected)
+        selected = find_kernel(getenv("DGEMM_KERNEL"));
+    for (int i = 0; !selected; ++i)
+        selected = find_kernel(dgemm_kernels[i]->isa);
+    return selected;
+}
+
+
+const smicro_kernel* select_skernel(void) {
+    if (!sselected)
+        sselected = find_skernel(getenv("DGEMM_KERNEL"));
+    for (int i = 0; !sselected; ++i)
+        sselected = find_skernel(sgemm_kernels[i]->isa);
+    return sselected;
+}
+
+
+void set_kernel(const micro_kernel* k) {
+    selected = k;
+}
+
+
+void set_skernel(const smicro_kernel* k) {
+    sselected = k;
+}
@@ -0,0 +1,48 @@
+/*
+ *  Portable fallback micro-kernels, built without any ISA flags: the
+ *  template on one-element "vectors".
+ */
+
+#include "kernel.h"
+
+#define KT_KERNEL micro_kernel
+#define KT_PREFIX kernel_
+#define KT_ISA "scalar"
+#define KT_T double
+#define KT_V double
+#define KT_LANES 1
+#define KT_MASK int
+#define KT_MASK_FOR(n) (n)
+#define KT_LOAD(p) (*(p))
+#define KT_LOADU(p) (*(p))
+#define KT_MLOAD(p, k) (*(p))
+#define KT_STOREU(p, v) (*(p) = (v))
+#define KT_MSTORE(p, k, v) (*(p) = (v))
+#define KT_BCAST(p) (*(p))
+#define KT_SET1(x) (x)
+#define KT_ZERO() 0.0
+#define KT_FMA(a, b, c) ((a) * (b) + (c))
+
+#define KT_NAME scalar_4x4
+#define KT_MR 4
+#define KT_NV 4
+#include "kernel-template.h"
+
+#undef KT_KERNEL
+#undef KT_PREFIX
+#undef KT_T
+#undef KT_V
+#undef KT_ZERO
+
+
+// Single precision, same loops on float
+#define KT_KERNEL smicro_kernel
+#define KT_PREFIX skernel_
+#define KT_T float
+#define KT_V float
+#define KT_ZERO() 0.0f
+
+#define KT_NAME scalar_4x4
+#define KT_MR 4
+#define KT_NV 4
+#include "kernel-template.h"
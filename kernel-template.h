@@ -0,0 +1,271 @@
+/*
+ *  Micro-kernel template: included once per register tile, it emits the
+ *  kernel, edge and small functions of kernel.h for an MR x NR tile and
+ *  the micro_kernel (or smicro_kernel) describing it.
+ *
+ *  The ISA file defines, once:
+ *    KT_KERNEL      micro_kernel or smicro_kernel
+ *    KT_PREFIX      kernel_ or skernel_, for the names of the objects
+ *    KT_ISA         "avx512", "avx2" or "scalar", for kernel-dispatch.c
+ *    KT_T, KT_V     element and vector types; KT_LANES elements per vector
+ *    KT_MASK        lane mask type; KT_MASK_FOR(n) enables the first n lanes
+ *    KT_LOAD(p), KT_LOADU(p), KT_MLOAD(p, k)          aligned, unaligned, masked
+ *    KT_STOREU(p, v), KT_MSTORE(p, k, v)
+ *    KT_BCAST(p)    *p in every lane
+ *    KT_SET1(x), KT_ZERO(), KT_FMA(a, b, c) = a * b + c
+ *  and per tile, before each inclusion:
+ *    KT_NAME        name of the tile, e.g. avx2_4x12; the object is KT_PREFIX KT_NAME
+ *    KT_MR          rows, up to 24
+ *    KT_NV          column vectors, up to 7: NR = KT_NV * KT_LANES
+ *
+ *  Every function is one always-inlined tile body instantiated with
+ *  constant rows / vectors, so the accumulators stay in registers; the
+ *  unroll pragmas make sure that holds for tall tiles too. Per step of K
+ *  the tile holds either the B row (NV vectors) while broadcasting A
+ *  element by element, or the MR broadcasts while streaming B, whichever
+ *  is fewer: MR * NV + min(MR, NV) + 1 registers, which must fit the ISA's
+ *  (16 ymm, 32 zmm). The per-tile macros are undefined at the end.
+ */
+
+#ifndef KT_ONCE
+#define KT_ONCE
+
+#define KT_CAT_(a, b) a##b
+#define KT_CAT(a, b) KT_CAT_(a, b)
+#define KT_CAT2_(a, b) a##b
+#define KT_CAT2(a, b) KT_CAT2_(a, b)
+#define KT_JOIN3_(a, b, c) a##b##c
+#define KT_JOIN3(a, b, c) KT_JOIN3_(a, b, c)
+#define KT_STR_(x) #x
+#define KT_STR(x) KT_STR_(x)
+
+// X(1) ... X(n): the rows of a switch
+#define KT_ROWS1(X) X(1)
+#define KT_ROWS2(X) KT_ROWS1(X) X(2)
+#define KT_ROWS3(X) KT_ROWS2(X) X(3)
+#define KT_ROWS4(X) KT_ROWS3(X) X(4)
+#define KT_ROWS5(X) KT_ROWS4(X) X(5)
+#define KT_ROWS6(X) KT_ROWS5(X) X(6)
+#define KT_ROWS7(X) KT_ROWS6(X) X(7)
+#define KT_ROWS8(X) KT_ROWS7(X) X(8)
+#define KT_ROWS9(X) KT_ROWS8(X) X(9)
+#define KT_ROWS10(X) KT_ROWS9(X) X(10)
+#define KT_ROWS11(X) KT_ROWS10(X) X(11)
+#define KT_ROWS12(X) KT_ROWS11(X) X(12)
+#define KT_ROWS13(X) KT_ROWS12(X) X(13)
+#define KT_ROWS14(X) KT_ROWS13(X) X(14)
+#define KT_ROWS15(X) KT_ROWS14(X) X(15)
+#define KT_ROWS16(X) KT_ROWS15(X) X(16)
+#define KT_ROWS17(X) KT_ROWS16(X) X(17)
+#define KT_ROWS18(X) KT_ROWS17(X) X(18)
+#define KT_ROWS19(X) KT_ROWS18(X) X(19)
+#define KT_ROWS20(X) KT_ROWS19(X) X(20)
+#define KT_ROWS21(X) KT_ROWS20(X) X(21)
+#define KT_ROWS22(X) KT_ROWS21(X) X(22)
+#define KT_ROWS23(X) KT_ROWS22(X) X(23)
+#define KT_ROWS24(X) KT_ROWS23(X) X(24)
+
+// X(m, 1) ... X(m, n): the column vectors of row m
+#define KT_COLS1(X, m) X(m, 1)
+#define KT_COLS2(X, m) KT_COLS1(X, m) X(m, 2)
+#define KT_COLS3(X, m) KT_COLS2(X, m) X(m, 3)
+#define KT_COLS4(X, m) KT_COLS3(X, m) X(m, 4)
+#define KT_COLS5(X, m) KT_COLS4(X, m) X(m, 5)
+#define KT_COLS6(X, m) KT_COLS5(X, m) X(m, 6)
+#define KT_COLS7(X, m) KT_COLS6(X, m) X(m, 7)
+
+#define KT_UNROLL _Pragma("GCC unroll 32")
+
+#endif
+
+
+#define KT_ID(f) KT_JOIN3(KT_PREFIX, KT_NAME, _##f)
+#define KT_NR (KT_NV * KT_LANES)
+
+
+// Elements per cache line, for the prefetches
+#define KT_LINE (64 / (int) sizeof(KT_T))
+
+// M <= MR rows and VN <= NV column vectors of C += A_sliver * B_sliver;
+// with masked set, the last vector only loads / stores the lanes in mask.
+// pf_a / pf_b > 0 prefetch A / B that many elements ahead, one line per
+// line of the step.
+static inline __attribute__((always_inline))
+void KT_ID(tile)(int M, int VN, int masked, KT_MASK mask, int K, const KT_T* restrict A, const KT_T* restrict B,
+                 KT_T* restrict C, int ldc, int pf_a, int pf_b) {
+    (void) mask;  // unused by the full-tile instances
+    KT_V c[KT_MR][KT_NV];
+
+    KT_UNROLL
+    for (int r = 0; r < M; ++r)
+        KT_UNROLL
+        for (int v = 0; v < VN; ++v)
+            c[r][v] = masked && v == VN - 1 ? KT_MLOAD(&C[r * ldc + KT_LANES * v], mask)
+                                            : KT_LOADU(&C[r * ldc + KT_LANES * v]);
+
+    for (int p = 0; p < K; ++p) {
+        if (pf_a > 0) {
+            KT_UNROLL
+            for (int l = 0; l < KT_MR; l += KT_LINE)
+                __builtin_prefetch(&A[pf_a + l], 0, 3);
+        }
+        if (pf_b > 0) {
+            KT_UNROLL
+            for (int l = 0; l < KT_NR; l += KT_LINE)
+                __builtin_prefetch(&B[pf_b + l], 0, 3);
+        }
+        if (KT_MR < KT_NV) {
+            KT_V a[KT_MR];
+            KT_UNROLL
+            for (int r = 0; r < M; ++r)
+                a[r] = KT_BCAST(&A[r]);
+            KT_UNROLL
+            for (int v = 0; v < VN; ++v) {
+                KT_V b = KT_LOAD(&B[KT_LANES * v]);
+                KT_UNROLL
+                for (int r = 0; r < M; ++r)
+                    c[r][v] = KT_FMA(a[r], b, c[r][v]);
+            }
+        }
+        else {
+            KT_V b[KT_NV];
+            KT_UNROLL
+            for (int v = 0; v < VN; ++v)
+                b[v] = KT_LOAD(&B[KT_LANES * v]);
+            KT_UNROLL
+            for (int r = 0; r < M; ++r) {
+                KT_V a = KT_BCAST(&A[r]);
+                KT_UNROLL
+                for (int v = 0; v < VN; ++v)
+                    c[r][v] = KT_FMA(a, b[v], c[r][v]);
+            }
+        }
+        A += KT_MR;
+        B += KT_NR;
+    }
+
+    KT_UNROLL
+    for (int r = 0; r < M; ++r)
+        KT_UNROLL
+        for (int v = 0; v < VN; ++v) {
+            if (masked && v == VN - 1)
+                KT_MSTORE(&C[r * ldc + KT_LANES * v], mask, c[r][v]);
+            else
+                KT_STOREU(&C[r * ldc + KT_LANES * v], c[r][v]);
+        }
+}
+
+
+static void KT_ID(kernel)(int K, const KT_T* restrict A, const KT_T* restrict B, KT_T* restrict C, int ldc,
+                         int pf_a, int pf_b) {
+    KT_ID(tile)(KT_MR, KT_NV, 0, KT_MASK_FOR(KT_LANES), K, A, B, C, ldc, pf_a, pf_b);
+}
+
+
+#define KT_EDGE(m, vn) case (m) * 8 + (vn) : KT_ID(tile)(m, vn, 1, mask, K, A, B, C, ldc, 0, 0); break;
+#define KT_EDGE_ROW(m) KT_CAT2(KT_COLS, KT_NV)(KT_EDGE, m)
+
+static void KT_ID(edge)(int m, int n, int K, const KT_T* restrict A, const KT_T* restrict B, KT_T* restrict C, int ldc) {
+    int vn = (n + KT_LANES - 1) / KT_LANES;
+    KT_MASK mask = KT_MASK_FOR(n - KT_LANES * (vn - 1));
+
+    switch (m * 8 + vn) {
+        KT_CAT(KT_ROWS, KT_MR)(KT_EDGE_ROW)
+    }
+}
+
+
+// Unpacked tile for the small function: A is read through its strides,
+// B rows are ldb apart and the last B vector is masked too, so nothing
+// past column n is touched. alpha is applied on the way out.
+static inline __attribute__((always_inline))
+void KT_ID(small_tile)(int M, int VN, KT_MASK mask, int K, KT_T alpha, const KT_T* restrict A, int rs_a, int cs_a,
+                       const KT_T* restrict B, int ldb, KT_T* restrict C, int ldc) {
+    (void) mask;  // unused by the full-tile instances
+    KT_V c[KT_MR][KT_NV];
+
+    KT_UNROLL
+    for (int r = 0; r < M; ++r)
+        KT_UNROLL
+        for (int v = 0; v < VN; ++v)
+            c[r][v] = KT_ZERO();
+
+    for (int p = 0; p < K; ++p) {
+        if (KT_MR < KT_NV) {
+            KT_V a[KT_MR];
+            KT_UNROLL
+            for (int r = 0; r < M; ++r)
+                a[r] = KT_BCAST(&A[r * rs_a + p * cs_a]);
+            KT_UNROLL
+            for (int v = 0; v < VN; ++v) {
+                KT_V b = v == VN - 1 ? KT_MLOAD(&B[p * ldb + KT_LANES * v], mask) : KT_LOADU(&B[p * ldb + KT_LANES * v]);
+                KT_UNROLL
+                for (int r = 0; r < M; ++r)
+                    c[r][v] = KT_FMA(a[r], b, c[r][v]);
+            }
+        }
+        else {
+            KT_V b[KT_NV];
+            KT_UNROLL
+            for (int v = 0; v < VN; ++v)
+                b[v] = v == VN - 1 ? KT_MLOAD(&B[p * ldb + KT_LANES * v], mask) : KT_LOADU(&B[p * ldb + KT_LANES * v]);
+            KT_UNROLL
+            for (int r = 0; r < M; ++r) {
+                KT_V a = KT_BCAST(&A[r * rs_a + p * cs_a]);
+                KT_UNROLL
+                for (int v = 0; v < VN; ++v)
+                    c[r][v] = KT_FMA(a, b[v], c[r][v]);
+            }
+        }
+    }
+
+    KT_V al = KT_SET1(alpha);
+    KT_UNROLL
+    for (int r = 0; r < M; ++r)
+        KT_UNROLL
+        for (int v = 0; v < VN; ++v) {
+            if (v == VN - 1)
+                KT_MSTORE(&C[r * ldc + KT_LANES * v], mask, KT_FMA(al, c[r][v], KT_MLOAD(&C[r * ldc + KT_LANES * v], mask)));
+            else
+                KT_STOREU(&C[r * ldc + KT_LANES * v], KT_FMA(al, c[r][v], KT_LOADU(&C[r * ldc + KT_LANES * v])));
+        }
+}
+
+
+#define KT_SMALL(m, vn) case (m) * 8 + (vn) : \
+    KT_ID(small_tile)(m, vn, mask, K, alpha, A + i * rs_a, rs_a, cs_a, B + j, ldb, C + i * ldc + j, ldc); break;
+#define KT_SMALL_ROW(m) KT_CAT2(KT_COLS, KT_NV)(KT_SMALL, m)
+
+static void KT_ID(small)(int M, int N, int K, KT_T alpha, const KT_T* restrict A, int rs_a, int cs_a,
+                         const KT_T* restrict B, int ldb, KT_T* restrict C, int ldc) {
+    for (int i = 0; i < M; i += KT_MR) {
+        int m = M - i < KT_MR ? M - i : KT_MR;
+
+        for (int j = 0; j < N; j += KT_NR) {
+            int n = N - j < KT_NR ? N - j : KT_NR;
+            int vn = (n + KT_LANES - 1) / KT_LANES;
+            KT_MASK mask = KT_MASK_FOR(n - KT_LANES * (vn - 1));
+
+            switch (m * 8 + vn) {
+                KT_CAT(KT_ROWS, KT_MR)(KT_SMALL_ROW)
+            }
+        }
+    }
+}
+
+
+const KT_KERNEL KT_CAT(KT_PREFIX, KT_NAME) = {
+    KT_STR(KT_NAME), KT_ISA, KT_MR, KT_NR, KT_ID(kernel), KT_ID(edge), KT_ID(small)
+};
+
+
+#undef KT_EDGE
+#undef KT_EDGE_ROW
+#undef KT_SMALL
+#undef KT_SMALL_ROW
+#undef KT_ID
+#undef KT_NR
+#undef KT_LINE
+#undef KT_NAME
+#undef KT_MR
+#undef KT_NV
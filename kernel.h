@@ -0,0 +1,81 @@
+#ifndef _KERNEL_H
+#define _KERNEL_H
+
+/*
+ * Register-tile micro-kernels.
+ *
+ * A kernel computes C[0:mr, 0:nr] += A_sliver * B_sliver over K, where
+ * A_sliver is mr rows packed k-major (A[p*mr + r]), B_sliver is nr
+ * columns packed row by row (B[p*nr + c]) and C has row stride ldc.
+ * B slivers are 64-byte aligned. pf_a / pf_b > 0 make it prefetch A / B
+ * that many elements ahead of the ones it is reading (past the end of the
+ * slivers, into the next ones in the packed buffers); 0 is off.
+ *
+ * The edge function does the same for a fringe tile of only m <= mr rows
+ * and n <= nr columns, touching nothing in C outside C[0:m, 0:n] and
+ * doing no FLOPs for the missing rows / column vectors.
+ *
+ * The small function multiplies a whole (small) problem without packing:
+ * C[0:M, 0:N] += alpha * A * B, where A(i, p) = A[i * rs_a + p * cs_a]
+ * and B is row-major with stride ldb. For tiny shapes packing costs more
+ * than it saves.
+ *
+ * Each ISA lives in its own translation unit built with its own flags,
+ * so only select_kernel() decides what actually runs on this host. The
+ * kernels are generated from kernel-template.h, one per register tile
+ * shape, and registered in the tables below.
+ *
+ * The smicro_kernel ones are the same contract on float, for sgemm.
+ */
+
+typedef void (*micro_kernel_fn)(int K, const double* A, const double* B, double* C, int ldc, int pf_a, int pf_b);
+typedef void (*micro_kernel_edge_fn)(int m, int n, int K, const double* A, const double* B, double* C, int ldc);
+typedef void (*micro_kernel_small_fn)(int M, int N, int K, double alpha, const double* A, int rs_a, int cs_a,
+                                      const double* B, int ldb, double* C, int ldc);
+
+typedef struct {
+    const char* name;   // ISA and tile, e.g. avx2_4x12
+    const char* isa;    // avx512, avx2 or scalar
+    int mr;
+    int nr;
+    micro_kernel_fn fn;
+    micro_kernel_edge_fn edge;
+    micro_kernel_small_fn small;
+} micro_kernel;
+
+// Every tile, widest ISA first and each ISA's default first; NULL-terminated
+extern const micro_kernel* const dgemm_kernels[];
+
+// The kernel in use: set_kernel's, or else DGEMM_KERNEL's if the CPU can
+// run it (a kernel name, or an ISA for its default tile), or else the
+// default tile of the widest ISA the CPU supports.
+const micro_kernel* select_kernel(void);
+// The kernel called name, or the default tile of the ISA called name;
+// NULL if there is none or the CPU can't run it
+const micro_kernel* find_kernel(const char* name);
+void set_kernel(const micro_kernel* k);
+
+
+typedef void (*smicro_kernel_fn)(int K, const float* A, const float* B, float* C, int ldc, int pf_a, int pf_b);
+typedef void (*smicro_kernel_edge_fn)(int m, int n, int K, const float* A, const float* B, float* C, int ldc);
+typedef void (*smicro_kernel_small_fn)(int M, int N, int K, float alpha, const float* A, int rs_a, int cs_a,
+                                       const float* B, int ldb, float* C, int ldc);
+
+typedef struct {
+    const char* name;
+    const char* isa;
+    int mr;
+    int nr;
+    smicro_kernel_fn fn;
+    smicro_kernel_edge_fn edge;
+    smicro_kernel_small_fn small;
+} smicro_kernel;
+
+extern const smicro_kernel* const sgemm_kernels[];
+
+// Same choice as select_kernel, among the float kernels
+const smicro_kernel* select_skernel(void);
+const smicro_kernel* find_skernel(const char* name);
+void set_skernel(const smicro_kernel* k);
+
+#endif
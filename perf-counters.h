@@ -0,0 +1,34 @@
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+/*
+ * Hardware counters for the benchmark, through perf_event_open. They
+ * count user-mode events of this process and every thread it starts after
+ * perf_open (the parallel pool's workers), each counter on its own so the
+ * kernel multiplexes them when there are more than the PMU has; counts
+ * are scaled up by the fraction of time a counter was scheduled.
+ */
+
+enum perf_counter {
+    PerfCycles,
+    PerfInstructions,
+    PerfRefCycles,      // at the nominal clock: cycles / ref_cycles is the frequency ratio
+    PerfL1DMisses,      // L1D read misses
+    PerfL2Misses,       // L2_RQSTS.MISS, Intel only
+    PerfLLCMisses,      // last-level cache read misses
+    PerfDTLBMisses,     // DTLB read misses
+    PerfPageFaults,     // software event, always available
+    PERF_COUNTERS
+};
+
+// Column names for the output, e.g. "l1d_misses"
+extern const char* perf_counter_names[PERF_COUNTERS];
+
+// Opens every counter the host and perf_event_paranoid allow; returns how
+// many that was. Call it before any threads to be counted are started.
+int perf_open(void);
+
+// Current totals, -1 for counters that couldn't be opened
+void perf_read(double counts[PERF_COUNTERS]);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ *  Roofline ceilings, measured at startup.
+ *
+ *  The peak loop keeps 16 accumulators in flight, enough to cover the
+ *  FMA latency on both ports of the cores we run on (4 cycles x 2 ports),
+ *  and is compiled per ISA with target attributes so one binary measures
+ *  whatever __builtin_cpu_supports finds, like kernel-dispatch.c. The
+ *  chains converge (x * 0.999999 + 1e-7), so they never reach denormals.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include "roofline.h"
+
+extern double wall_time();
+
+#define CHAINS 16
+// Seconds each measurement lasts at least
+#define MIN_TIME 0.05
+
+
+__attribute__((target("avx512f,fma")))
+static double fma_avx512(long iters, double* sink) {
+    __m512d acc[CHAINS];
+    __m512d x = _mm512_set1_pd(0.999999), y = _mm512_set1_pd(1e-7);
+    for (int c = 0; c < CHAINS; ++c)
+        acc[c] = _mm512_set1_pd(c);
+    for (long i = 0; i < iters; ++i)
+        for (int c = 0; c < CHAINS; ++c)
+            acc[c] = _mm512_fmadd_pd(acc[c], x, y);
+    for (int c = 1; c < CHAINS; ++c)
+        acc[0] = _mm512_add_pd(acc[0], acc[c]);
+    *sink = _mm512_reduce_add_pd(acc[0]);
+    return 2.0 * 8 * CHAINS * iters;
+}
+
+
+__attribute__((target("avx2,fma")))
+static double fma_avx2(long iters, double* sink) {
+    __m256d acc[CHAINS];
+    __m256d x = _mm256_set1_pd(0.999999), y = _mm256_set1_pd(1e-7);
+    for (int c = 0; c < CHAINS; ++c)
+        acc[c] = _mm256_set1_pd(c);
+    for (long i = 0; i < iters; ++i)
+        for (int c = 0; c < CHAINS; ++c)
+            acc[c] = _mm256_fmadd_pd(acc[c], x, y);
+    double lanes[4];
+    for (int c = 1; c < CHAINS; ++c)
+        acc[0] = _mm256_add_pd(acc[0], acc[c]);
+    _mm256_storeu_pd(lanes, acc[0]);
+    *sink = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return 2.0 * 4 * CHAINS * iters;
+}
+
+
+// Separate multiply and add, as the scalar micro-kernel has
+static double fma_scalar(long iters, double* sink) {
+    double acc[CHAINS];
+    for (int c = 0; c < CHAINS; ++c)
+        acc[c] = c;
+    for (long i = 0; i < iters; ++i)
+        for (int c = 0; c < CHAINS; ++c)
+            acc[c] = acc[c] * 0.999999 + 1e-7;
+    *sink = 0.0;
+    for (int c = 0; c < CHAINS; ++c)
+        *sink += acc[c];
+    return 2.0 * CHAINS * iters;
+}
+
+
+double roofline_peak_gflops(const char** isa) {
+    double (*loop)(long, double*) = fma_scalar;
+    const char* name = "scalar";
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        loop = fma_avx512;
+        name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        loop = fma_avx2;
+        name = "avx2";
+    }
+    if (isa)
+        *isa = name;
+
+    // Doubled until one run lasts MIN_TIME (which also ramps the clock
+    // up), then the best of three
+    double sink, best = 0.0;
+    long iters = 1 << 12;
+    for (;;) {
+        double t = -wall_time();
+        loop(iters, &sink);
+        t += wall_time();
+        if (t >= MIN_TIME)
+            break;
+        iters *= 2;
+    }
+    for (int r = 0; r < 3; ++r) {
+        double t = -wall_time();
+        double flops = loop(iters, &sink);
+        t += wall_time();
+        if (flops / t > best)
+            best = flops / t;
+    }
+    return 1.e-9 * best;
+}
+
+
+double roofline_bandwidth_gbs(void) {
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (llc <= 0)
+        llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    // Each array at least the whole LLC (so the three are 3x it), bounded
+    // so the measurement stays quick on the hosts with huge shared L3s
+    size_t bytes = llc > (16L << 20) ? (size_t) llc : (size_t) 16 << 20;
+    if (bytes > ((size_t) 256 << 20))
+        bytes = (size_t) 256 << 20;
+    size_t n = bytes / sizeof(double);
+    double* a = (double*) malloc(3 * bytes);
+    if (!a)
+        return 0.0;
+    double* b = a + n;
+    double* c = b + n;
+    // First touch, so the timed passes don't fault the pages in
+    for (size_t i = 0; i < n; ++i) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+
+    double best = 0.0;
+    for (int r = 0; r < 5; ++r) {
+        double t = -wall_time();
+        for (size_t i = 0; i < n; ++i)
+            a[i] = b[i] + 3.0 * c[i];
+        t += wall_time();
+        if (3.0 * bytes / t > best)
+            best = 3.0 * bytes / t;
+    }
+    // Keep the stores
+    volatile double sink = a[n / 2];
+    (void) sink;
+    free(a);
+    return 1.e-9 * best;
+}
@@ -0,0 +1,20 @@
+#ifndef _ROOFLINE_H
+#define _ROOFLINE_H
+
+/*
+ * The two ceilings of the roofline model for one core, measured on the
+ * host: peak FMA throughput and sustained memory bandwidth. A kernel with
+ * operational intensity I (flops per byte of memory traffic) can reach at
+ * most min(peak, I * bandwidth).
+ */
+
+// Peak double-precision Gflop/s of one core: independent FMA chains on the
+// widest vectors the cpu has (avx512, avx2, or scalar); isa gets which
+double roofline_peak_gflops(const char** isa);
+
+// Sustained bandwidth of one thread in GB/s: the best STREAM triad
+// a = b + s * c over arrays well past the last-level cache, counting 24
+// bytes per element as STREAM does
+double roofline_bandwidth_gbs(void);
+
+#endif
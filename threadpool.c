@@ -0,0 +1,326 @@
+/*
+ *  Persistent pthread worker pool used by the parallel dgemm.
+ *
+ *  Workers are started on the first pool_run and then sleep on a
+ *  condition variable between calls, so repeated square_dgemm calls
+ *  don't pay thread creation. Each worker owns a [head, tail) range of
+ *  task indices packed into one 64-bit word; the owner pops from the
+ *  head and thieves pop from the tail, both with a single CAS.
+ *  NUMA builds pin the workers, see threadpool.h.
+ */
+
+#ifdef NUMA
+#define _GNU_SOURCE     // sched_getcpu, the affinity calls
+#endif
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef NUMA
+#include <numa.h>
+#include <sched.h>
+#endif
+#include "threadpool.h"
+
+#define MAX_THREADS 256
+#define CACHE_LINE 64
+#define WORKER_STACK_SIZE (16 << 20)
+
+typedef struct {
+    _Atomic uint64_t range;     // low 32 bits: head, high 32 bits: tail
+    char pad[CACHE_LINE - sizeof(uint64_t)];
+} __attribute__(( aligned(CACHE_LINE))) task_range;
+
+#define RANGE(head, tail) (((uint64_t)(tail) << 32) | (uint32_t)(head))
+#define HEAD(r) ((int)(uint32_t)(r))
+#define TAIL(r) ((int)((r) >> 32))
+
+static task_range ranges[MAX_THREADS];
+static pthread_t threads[MAX_THREADS];
+
+static int requested_threads = 0;   // 0: DGEMM_NUM_THREADS or all online cpus
+static int num_threads = 0;         // 0: pool not started
+static int num_nodes = 1;
+static int worker_node[MAX_THREADS];        // index into node_ids
+static int node_ids[POOL_MAX_NODES];        // system node numbers
+
+static pthread_mutex_t owner = PTHREAD_MUTEX_INITIALIZER;    // held by the caller using the pool
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long generation = 0;
+static int busy = 0;
+static int shutting_down = 0;
+static pool_fn job_fn;
+static void* job_arg;
+
+
+static void* worker_main(void* arg) {
+    int worker = (int) (intptr_t) arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (generation == seen && !shutting_down)
+            pthread_cond_wait(&start_cond, &lock);
+        if (shutting_down)
+            break;
+        seen = generation;
+        pthread_mutex_unlock(&lock);
+
+        job_fn(job_arg, worker);
+
+        pthread_mutex_lock(&lock);
+        if (--busy == 0)
+            pthread_cond_signal(&done_cond);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+
+static int default_threads(void) {
+    const char* env = getenv("DGEMM_NUM_THREADS");
+    int n = env ? atoi(env) : 0;
+    if (n <= 0)
+        n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    return n;
+}
+
+
+#ifdef NUMA
+// Cpus of each node the process may run on, the caller's node first.
+// Returns the number of such nodes, 0 if NUMA placement is off.
+static int numa_layout(struct bitmask* cpus[POOL_MAX_NODES], int nodes[POOL_MAX_NODES]) {
+    const char* env = getenv("DGEMM_NUMA");
+    if ((env && atoi(env) == 0) || numa_available() < 0)
+        return 0;
+
+    struct bitmask* allowed = numa_allocate_cpumask();
+    numa_sched_getaffinity(0, allowed);
+    int first = numa_node_of_cpu(sched_getcpu());
+    int max_node = numa_max_node();
+    int count = 0;
+    for (int i = 0; i <= max_node && count < POOL_MAX_NODES; ++i) {
+        int node = (first + i) % (max_node + 1);
+        struct bitmask* mask = numa_allocate_cpumask();
+        numa_node_to_cpus(node, mask);
+        int usable = 0;
+        for (unsigned c = 0; c < mask->size; ++c) {
+            if (numa_bitmask_isbitset(mask, c) && !numa_bitmask_isbitset(allowed, c))
+                numa_bitmask_clearbit(mask, c);
+            usable += numa_bitmask_isbitset(mask, c);
+        }
+        if (usable == 0) {
+            numa_free_cpumask(mask);
+            continue;
+        }
+        cpus[count] = mask;
+        nodes[count++] = node;
+    }
+    numa_free_cpumask(allowed);
+    return count;
+}
+
+
+// The k-th cpu (mod their number) in mask, as a cpu_set_t
+static void nth_cpu(struct bitmask* mask, int k, cpu_set_t* set) {
+    int usable = numa_bitmask_weight(mask);
+    k %= usable;
+    CPU_ZERO(set);
+    for (unsigned c = 0; c < mask->size; ++c)
+        if (numa_bitmask_isbitset(mask, c) && k-- == 0) {
+            CPU_SET(c, set);
+            return;
+        }
+}
+#endif
+
+
+// Starts workers 1..n-1, split over the nodes for n; returns how many
+// workers there are then, the calling thread included.
+static int start_workers(int n) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+
+    num_nodes = 1;
+    node_ids[0] = 0;
+    for (int w = 0; w < n; ++w)
+        worker_node[w] = 0;
+#ifdef NUMA
+    // Workers n*g/count .. n*(g+1)/count - 1 go to the g-th node, on its
+    // cpus in turn. A worker is pinned before it starts, so its stack is
+    // node-local too. Worker 0 is whichever thread calls pool_run, so it
+    // is left unpinned: the application's threads keep their affinity.
+    struct bitmask* cpus[POOL_MAX_NODES];
+    int nodes[POOL_MAX_NODES];
+    int count = numa_layout(cpus, nodes);
+    while (count > n)
+        numa_free_cpumask(cpus[--count]);
+    cpu_set_t set;
+    for (int g = 0; g < count; ++g) {
+        node_ids[g] = nodes[g];
+        for (int w = n * g / count; w < n * (g + 1) / count; ++w)
+            worker_node[w] = g;
+    }
+    if (count > 0)
+        num_nodes = count;
+#endif
+
+    shutting_down = 0;
+    num_threads = 1;
+    for (int w = 1; w < n; ++w) {
+#ifdef NUMA
+        if (count > 0) {
+            int g = worker_node[w];
+            nth_cpu(cpus[g], w - n * g / count, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+#endif
+        if (pthread_create(&threads[w], &attr, worker_main, (void*) (intptr_t) w) != 0)
+            break;
+        num_threads++;
+    }
+    pthread_attr_destroy(&attr);
+#ifdef NUMA
+    for (int g = 0; g < count; ++g)
+        numa_free_cpumask(cpus[g]);
+#endif
+    return num_threads;
+}
+
+
+static void pool_stop(void) {
+    pthread_mutex_lock(&lock);
+    shutting_down = 1;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&lock);
+
+    for (int w = 1; w < num_threads; ++w)
+        pthread_join(threads[w], NULL);
+    num_threads = 0;
+
+    // The next pool's workers start from seen = 0; a generation left over
+    // from this one would send them straight into its last job
+    pthread_mutex_lock(&lock);
+    generation = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+
+// If some workers can't be created, the pool restarts with as many as
+// could, so the node split matches the workers that exist
+static void pool_start(void) {
+    int n = requested_threads > 0 ? requested_threads : default_threads();
+    if (n < 1)
+        n = 1;
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+
+    int started;
+    while ((started = start_workers(n)) < n) {
+        pool_stop();
+        n = started;
+    }
+}
+
+
+int pool_try_acquire(void) {
+    return pthread_mutex_trylock(&owner) == 0;
+}
+
+
+void pool_release(void) {
+    pthread_mutex_unlock(&owner);
+}
+
+
+void pool_set_num_threads(int nthreads) {
+    pthread_mutex_lock(&owner);
+    if (num_threads != 0 && nthreads != num_threads)
+        pool_stop();
+    requested_threads = nthreads;
+    pthread_mutex_unlock(&owner);
+}
+
+
+int pool_num_threads(void) {
+    if (num_threads == 0)
+        pool_start();
+    return num_threads;
+}
+
+
+void pool_run(int ntasks, pool_fn fn, void* arg) {
+    int p = pool_num_threads();
+
+    for (int w = 0; w < p; ++w) {
+        int head = (int) ((long) ntasks * w / p);
+        int tail = (int) ((long) ntasks * (w + 1) / p);
+        atomic_store_explicit(&ranges[w].range, RANGE(head, tail), memory_order_relaxed);
+    }
+
+    if (p == 1) {
+        fn(arg, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    job_fn = fn;
+    job_arg = arg;
+    busy = p - 1;
+    generation++;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&lock);
+
+    fn(arg, 0);
+
+    pthread_mutex_lock(&lock);
+    while (busy != 0)
+        pthread_cond_wait(&done_cond, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+
+int pool_next_task(int worker) {
+    // Own slice first, from the head so a worker walks its tasks in order
+    task_range* own = &ranges[worker];
+    uint64_t r = atomic_load(&own->range);
+    while (HEAD(r) < TAIL(r)) {
+        if (atomic_compare_exchange_weak(&own->range, &r, RANGE(HEAD(r) + 1, TAIL(r))))
+            return HEAD(r);
+    }
+
+    // Then steal from the tail of the others, starting with our neighbour:
+    // first on our own node, then (with several nodes) anywhere
+    for (int v = 1; v < num_threads * (num_nodes > 1 ? 2 : 1); ++v) {
+        int w = (worker + v) % num_threads;
+        if ((v < num_threads) != (worker_node[w] == worker_node[worker]))
+            continue;
+        task_range* victim = &ranges[w];
+        r = atomic_load(&victim->range);
+        while (HEAD(r) < TAIL(r)) {
+            if (atomic_compare_exchange_weak(&victim->range, &r, RANGE(HEAD(r), TAIL(r) - 1)))
+                return TAIL(r) - 1;
+        }
+    }
+    return -1;
+}
+
+
+int pool_num_nodes(void) {
+    pool_num_threads();
+    return num_nodes;
+}
+
+
+int pool_worker_node(int worker) {
+    return worker_node[worker];
+}
+
+
+int pool_node_id(int node) {
+    return node_ids[node];
+}
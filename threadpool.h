@@ -0,0 +1,43 @@
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+/*
+ * Persistent worker pool with work stealing.
+ *
+ * pool_run(ntasks, fn, arg) hands tasks 0..ntasks-1 out in contiguous
+ * slices (one per worker) and calls fn(arg, worker) once on every worker,
+ * the calling thread being worker 0. Inside fn, a worker pulls task
+ * indices with pool_next_task(worker) until it returns -1; once its own
+ * slice is empty it steals from the tail of the other slices.
+ *
+ * The pool serves one caller at a time. pool_try_acquire claims it, or
+ * returns 0 if another thread holds it; the holder may then call pool_run,
+ * pool_num_threads and pool_num_nodes until pool_release. Callers that
+ * can't claim it are expected to do their work on their own thread.
+ * pool_set_num_threads waits for the holder to release it.
+ *
+ * Built with -DNUMA, the workers are pinned to cpus, grouped by NUMA node
+ * starting at the one the pool was started from; the calling thread,
+ * worker 0, counts as on that node but keeps its own affinity. Worker w is
+ * on node pool_worker_node(w), of pool_num_nodes(), numbered from 0 in
+ * that order (pool_node_id gives the system's number), and the contiguous
+ * task slices give each node one contiguous range of tasks. DGEMM_NUMA=0 turns
+ * that off; so does a kernel without NUMA support. Otherwise there is one
+ * node and nothing is pinned.
+ */
+
+#define POOL_MAX_NODES 16
+
+typedef void (*pool_fn)(void* arg, int worker);
+
+int pool_try_acquire(void);
+void pool_release(void);
+void pool_set_num_threads(int nthreads);
+int pool_num_threads(void);
+void pool_run(int ntasks, pool_fn fn, void* arg);
+int pool_next_task(int worker);
+int pool_num_nodes(void);
+int pool_worker_node(int worker);
+int pool_node_id(int node);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ *  Repeated-trial timing with order statistics.
+ *
+ *  A warm sample batches enough calls to last min_time, so the clock's
+ *  resolution and the call overhead are amortised the same way the old
+ *  doubling loop did, but the result is the median of several samples
+ *  rather than the last one. A cold sample first streams twice the
+ *  last-level cache through a scratch buffer, evicting the operands, and
+ *  times a single call.
+ */
+
+#define _GNU_SOURCE     // sched_setaffinity
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "timing.h"
+
+extern double wall_time();
+
+static char* flush_buf;
+static size_t flush_size;
+
+
+static void flush_caches(void) {
+    if (!flush_buf) {
+        long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (llc <= 0)
+            llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        if (llc <= 0)
+            llc = 32L << 20;
+        flush_size = 2 * (size_t) llc;
+        flush_buf = (char*) malloc(flush_size);
+        if (!flush_buf)
+            abort();
+    }
+    // Write every line, then read them back so the stores can't be elided
+    volatile char sink = 0;
+    for (size_t i = 0; i < flush_size; i += 64)
+        flush_buf[i] = (char) i;
+    for (size_t i = 0; i < flush_size; i += 64)
+        sink += flush_buf[i];
+    (void) sink;
+}
+
+
+static int compare(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+
+// The q-quantile of n sorted samples, interpolating between ranks
+static double quantile(const double* sorted, int n, double q) {
+    double pos = q * (n - 1);
+    int lo = (int) pos;
+    if (lo >= n - 1)
+        return sorted[n - 1];
+    return sorted[lo] + (pos - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+
+void time_trials(timed_fn fn, void* arg, const timing_options* opt, timing_stats* stats) {
+    int trials = opt->trials > 0 ? opt->trials : 1;
+    if (trials > TIMING_MAX_SAMPLES)
+        trials = TIMING_MAX_SAMPLES;
+    double* samples = (double*) malloc(trials * sizeof(double));
+    if (!samples)
+        abort();
+
+    for (int i = 0; i < opt->warmup; ++i)
+        fn(arg);
+
+    // Calls per sample: doubled until one batch lasts min_time. The
+    // calibration batches are more warm-up.
+    long calls = 1;
+    if (!opt->cold)
+        for (;;) {
+            double t = -wall_time();
+            for (long i = 0; i < calls; ++i)
+                fn(arg);
+            t += wall_time();
+            if (t >= opt->min_time)
+                break;
+            calls *= 2;
+        }
+
+    for (int s = 0; s < trials; ++s) {
+        if (opt->cold)
+            flush_caches();
+        if (opt->sample_hook)
+            opt->sample_hook(opt->hook_ctx, 0);
+        double t = -wall_time();
+        for (long i = 0; i < calls; ++i)
+            fn(arg);
+        t += wall_time();
+        if (opt->sample_hook)
+            opt->sample_hook(opt->hook_ctx, 1);
+        samples[s] = t / calls;
+    }
+
+    double sum = 0.0, sq = 0.0;
+    for (int s = 0; s < trials; ++s)
+        sum += samples[s];
+    double mean = sum / trials;
+    for (int s = 0; s < trials; ++s)
+        sq += (samples[s] - mean) * (samples[s] - mean);
+    memcpy(stats->samples, samples, trials * sizeof(double));
+
+    qsort(samples, trials, sizeof(double), compare);
+    stats->trials = trials;
+    stats->calls = calls * trials;
+    stats->min = samples[0];
+    stats->median = quantile(samples, trials, 0.5);
+    stats->p5 = quantile(samples, trials, 0.05);
+    stats->p95 = quantile(samples, trials, 0.95);
+    stats->mean = mean;
+    stats->stddev = trials > 1 ? sqrt(sq / (trials - 1)) : 0.0;
+    free(samples);
+}
+
+
+int pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
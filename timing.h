@@ -0,0 +1,39 @@
+#ifndef _TIMING_H
+#define _TIMING_H
+
+/*
+ * Timing harness for the benchmark and the autotuner: warm-up calls, then
+ * repeated timed samples on wall_time (CLOCK_MONOTONIC), summarised as
+ * order statistics so one preempted sample doesn't move the result.
+ */
+
+typedef struct {
+    int warmup;         // untimed calls before calibrating
+    int trials;         // timed samples
+    double min_time;    // seconds a warm sample lasts at least; calls are batched to reach it
+    int cold;           // flush the caches before every sample, which is then one call
+    // Called with end = 0 / 1 right before / after each timed sample, or NULL
+    void (*sample_hook)(void* ctx, int end);
+    void* hook_ctx;
+} timing_options;
+
+// Samples kept per measurement; more trials than this are clamped
+#define TIMING_MAX_SAMPLES 256
+
+// Seconds per call over the samples
+typedef struct {
+    int trials;
+    long calls;         // timed calls, all samples together
+    double min, median, p5, p95;
+    double mean, stddev;
+    double samples[TIMING_MAX_SAMPLES];     // each sample, in the order taken
+} timing_stats;
+
+typedef void (*timed_fn)(void* arg);
+
+void time_trials(timed_fn fn, void* arg, const timing_options* opt, timing_stats* stats);
+
+// Pins the calling thread to cpu; returns nonzero on failure
+int pin_to_cpu(int cpu);
+
+#endif